@@ -0,0 +1,314 @@
+#include "aggregate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define AGGREGATE_ARENA_BLOCK_SIZE (64 * 1024)
+#define AGGREGATE_INITIAL_SIZE 64
+
+#define AGGREGATE_ORDER(a, b) (((a) > (b)) - ((a) < (b)))
+
+struct aggregate * aggregate_new(unsigned int keys_amount, unsigned int amount, const enum json_api_aggregate * functions) {
+    struct aggregate * aggregate = malloc(sizeof(*aggregate));
+
+    aggregate->arena = arena_new(AGGREGATE_ARENA_BLOCK_SIZE);
+    aggregate->keys_amount = keys_amount;
+
+    aggregate->aggregates.amount = amount;
+    aggregate->aggregates.functions = arena_alloc(aggregate->arena, sizeof(*functions) * amount);
+    memcpy(aggregate->aggregates.functions, functions, sizeof(*functions) * amount);
+
+    aggregate->groups.amount = 0;
+    aggregate->groups.size = AGGREGATE_INITIAL_SIZE;
+    aggregate->groups.buckets = calloc(AGGREGATE_INITIAL_SIZE, sizeof(*aggregate->groups.buckets));
+
+    aggregate->first = NULL;
+    aggregate->last = NULL;
+
+    return aggregate;
+}
+
+void aggregate_delete(struct aggregate * aggregate) {
+    if (aggregate) {
+        for (struct aggregate_group * group = aggregate->first; group; group = group->next) {
+            for (unsigned int i = 0; i < aggregate->aggregates.amount; ++i) {
+                struct aggregate_state * state = &group->states[i];
+
+                if (state->count > 0 && state->value.type == STORAGE_COLUMN_TYPE_STR) {
+                    free(state->value.value.str);
+                }
+            }
+        }
+
+        free(aggregate->groups.buckets);
+        arena_delete(aggregate->arena);
+    }
+
+    free(aggregate);
+}
+
+static uint64_t aggregate_hash(struct database_value ** keys, unsigned int amount) {
+    uint64_t hash = 0;
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        hash ^= database_value_hash(keys[i]) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+
+    return hash;
+}
+
+static bool aggregate_keys_equal(struct database_value ** left, struct database_value ** right, unsigned int amount) {
+    for (unsigned int i = 0; i < amount; ++i) {
+        if (!database_value_equals(left[i], right[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void aggregate_grow(struct aggregate * aggregate) {
+    size_t size = aggregate->groups.size;
+    struct aggregate_group ** buckets = aggregate->groups.buckets;
+
+    aggregate->groups.size = 2 * size;
+    aggregate->groups.buckets = calloc(aggregate->groups.size, sizeof(*aggregate->groups.buckets));
+
+    for (size_t i = 0; i < size; ++i) {
+        struct aggregate_group * group = buckets[i];
+
+        while (group) {
+            struct aggregate_group * next = group->next_in_bucket;
+            struct aggregate_group ** bucket = &aggregate->groups.buckets[group->hash % aggregate->groups.size];
+
+            group->next_in_bucket = *bucket;
+            *bucket = group;
+            group = next;
+        }
+    }
+
+    free(buckets);
+}
+
+static struct aggregate_group * aggregate_insert(struct aggregate * aggregate, struct database_value ** keys, uint64_t hash) {
+    if (aggregate->groups.amount >= aggregate->groups.size) {
+        aggregate_grow(aggregate);
+    }
+
+    size_t states_size = sizeof(struct aggregate_state) * aggregate->aggregates.amount;
+    struct aggregate_group * group = arena_alloc(aggregate->arena, sizeof(*group) + states_size);
+
+    group->hash = hash;
+    group->next = NULL;
+    group->keys = arena_alloc(aggregate->arena, sizeof(*group->keys) * aggregate->keys_amount);
+    memset(group->states, 0, states_size);
+
+    for (unsigned int i = 0; i < aggregate->keys_amount; ++i) {
+        group->keys[i] = NULL;
+
+        if (keys[i]) {
+            group->keys[i] = arena_alloc(aggregate->arena, sizeof(*group->keys[i]));
+            *group->keys[i] = *keys[i];
+
+            if (keys[i]->type == STORAGE_COLUMN_TYPE_STR) {
+                group->keys[i]->value.str = arena_strdup(aggregate->arena, keys[i]->value.str);
+            }
+        }
+    }
+
+    struct aggregate_group ** bucket = &aggregate->groups.buckets[hash % aggregate->groups.size];
+    group->next_in_bucket = *bucket;
+    *bucket = group;
+    ++aggregate->groups.amount;
+
+    if (aggregate->last) {
+        aggregate->last->next = group;
+    } else {
+        aggregate->first = group;
+    }
+
+    aggregate->last = group;
+    return group;
+}
+
+static int aggregate_compare(const struct database_value * left, const struct database_value * right) {
+    switch (left->type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            return AGGREGATE_ORDER(left->value._int, right->value._int);
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            return AGGREGATE_ORDER(left->value.uint, right->value.uint);
+
+        case STORAGE_COLUMN_TYPE_NUM:
+            return AGGREGATE_ORDER(left->value.num, right->value.num);
+
+        case STORAGE_COLUMN_TYPE_STR:
+            return strcmp(left->value.str, right->value.str);
+    }
+
+    return 0;
+}
+
+static double aggregate_to_num(const struct database_value * value) {
+    switch (value->type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            return (double) value->value._int;
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            return (double) value->value.uint;
+
+        default:
+            return value->value.num;
+    }
+}
+
+static void aggregate_update(enum json_api_aggregate function, struct aggregate_state * state, const struct database_value * value) {
+    if (!value) {
+        return;
+    }
+
+    bool first = state->count++ == 0;
+
+    switch (function) {
+        case JSON_API_AGGREGATE_SUM:
+            if (first) {
+                state->value = *value;
+                break;
+            }
+
+            switch (value->type) {
+                case STORAGE_COLUMN_TYPE_INT:
+                    state->value.value._int += value->value._int;
+                    break;
+
+                case STORAGE_COLUMN_TYPE_UINT:
+                    state->value.value.uint += value->value.uint;
+                    break;
+
+                default:
+                    state->value.value.num += value->value.num;
+                    break;
+            }
+
+            break;
+
+        case JSON_API_AGGREGATE_AVG:
+            state->value.type = STORAGE_COLUMN_TYPE_NUM;
+            state->value.value.num += aggregate_to_num(value);
+            break;
+
+        case JSON_API_AGGREGATE_MIN:
+        case JSON_API_AGGREGATE_MAX:
+            if (!first) {
+                int order = aggregate_compare(value, &state->value);
+
+                if (function == JSON_API_AGGREGATE_MIN ? order >= 0 : order <= 0) {
+                    break;
+                }
+
+                if (state->value.type == STORAGE_COLUMN_TYPE_STR) {
+                    free(state->value.value.str);
+                }
+            }
+
+            state->value = *value;
+
+            if (value->type == STORAGE_COLUMN_TYPE_STR) {
+                state->value.value.str = strdup(value->value.str);
+            }
+
+            break;
+
+        default:
+            break;
+    }
+}
+
+void aggregate_add(struct aggregate * aggregate, struct database_value ** keys, struct database_value ** values) {
+    uint64_t hash = aggregate_hash(keys, aggregate->keys_amount);
+    struct aggregate_group * group = aggregate->groups.buckets[hash % aggregate->groups.size];
+
+    while (group && (group->hash != hash || !aggregate_keys_equal(group->keys, keys, aggregate->keys_amount))) {
+        group = group->next_in_bucket;
+    }
+
+    if (!group) {
+        group = aggregate_insert(aggregate, keys, hash);
+    }
+
+    for (unsigned int i = 0; i < aggregate->aggregates.amount; ++i) {
+        aggregate_update(aggregate->aggregates.functions[i], &group->states[i], values[i]);
+    }
+}
+
+struct aggregate_group * aggregate_finish(struct aggregate * aggregate) {
+    if (aggregate->keys_amount == 0 && !aggregate->first) {
+        aggregate_insert(aggregate, NULL, 0);
+    }
+
+    return aggregate->first;
+}
+
+bool aggregate_is_applicable(enum json_api_aggregate function, enum database_column_type type) {
+    switch (function) {
+        case JSON_API_AGGREGATE_COUNT:
+        case JSON_API_AGGREGATE_MIN:
+        case JSON_API_AGGREGATE_MAX:
+            return true;
+
+        case JSON_API_AGGREGATE_SUM:
+        case JSON_API_AGGREGATE_AVG:
+            return type != STORAGE_COLUMN_TYPE_STR;
+
+        default:
+            return false;
+    }
+}
+
+enum database_column_type aggregate_get_type(enum json_api_aggregate function, enum database_column_type type) {
+    switch (function) {
+        case JSON_API_AGGREGATE_COUNT:
+            return STORAGE_COLUMN_TYPE_UINT;
+
+        case JSON_API_AGGREGATE_AVG:
+            return STORAGE_COLUMN_TYPE_NUM;
+
+        default:
+            return type;
+    }
+}
+
+struct database_value * aggregate_get_value(struct aggregate * aggregate, struct aggregate_group * group, unsigned int index,
+                                            struct arena * arena) {
+    struct aggregate_state * state = &group->states[index];
+    enum json_api_aggregate function = aggregate->aggregates.functions[index];
+
+    if (function != JSON_API_AGGREGATE_COUNT && state->count == 0) {
+        return NULL;
+    }
+
+    struct database_value * value = arena_alloc(arena, sizeof(*value));
+
+    switch (function) {
+        case JSON_API_AGGREGATE_COUNT:
+            value->type = STORAGE_COLUMN_TYPE_UINT;
+            value->value.uint = state->count;
+            break;
+
+        case JSON_API_AGGREGATE_AVG:
+            value->type = STORAGE_COLUMN_TYPE_NUM;
+            value->value.num = state->value.value.num / (double) state->count;
+            break;
+
+        default:
+            *value = state->value;
+
+            if (value->type == STORAGE_COLUMN_TYPE_STR) {
+                value->value.str = arena_strdup(arena, state->value.value.str);
+            }
+
+            break;
+    }
+
+    return value;
+}
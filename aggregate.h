@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "database.h"
+#include "json_commands.h"
+
+struct aggregate_state {
+    unsigned long long count;
+    struct database_value value;
+};
+
+struct aggregate_group {
+    struct aggregate_group * next_in_bucket;
+    struct aggregate_group * next;
+    uint64_t hash;
+
+    struct database_value ** keys;
+    struct aggregate_state states[];
+};
+
+struct aggregate {
+    struct arena * arena;
+    unsigned int keys_amount;
+
+    struct {
+        unsigned int amount;
+        enum json_api_aggregate * functions;
+    } aggregates;
+
+    struct {
+        size_t amount;
+        size_t size;
+        struct aggregate_group ** buckets;
+    } groups;
+
+    struct aggregate_group * first;
+    struct aggregate_group * last;
+};
+
+struct aggregate * aggregate_new(unsigned int keys_amount, unsigned int amount, const enum json_api_aggregate * functions);
+void aggregate_delete(struct aggregate * aggregate);
+
+void aggregate_add(struct aggregate * aggregate, struct database_value ** keys, struct database_value ** values);
+struct aggregate_group * aggregate_finish(struct aggregate * aggregate);
+
+bool aggregate_is_applicable(enum json_api_aggregate function, enum database_column_type type);
+enum database_column_type aggregate_get_type(enum json_api_aggregate function, enum database_column_type type);
+struct database_value * aggregate_get_value(struct aggregate * aggregate, struct aggregate_group * group, unsigned int index,
+                                            struct arena * arena);
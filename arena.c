@@ -0,0 +1,95 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT (sizeof(max_align_t))
+
+struct arena * arena_new(size_t block_size) {
+    struct arena * arena = malloc(sizeof(*arena));
+
+    arena->block_size = block_size;
+    arena->blocks = NULL;
+    arena->spare = NULL;
+
+    return arena;
+}
+
+static void arena_release(struct arena * arena, struct arena_block * block) {
+    if (block->size == arena->block_size && !arena->spare) {
+        arena->spare = block;
+        return;
+    }
+
+    free(block);
+}
+
+void arena_delete(struct arena * arena) {
+    if (arena) {
+        arena_reset(arena);
+        free(arena->spare);
+    }
+
+    free(arena);
+}
+
+void * arena_alloc(struct arena * arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    struct arena_block * block = arena->blocks;
+
+    if (!block || block->size - block->used < size) {
+        if (size <= arena->block_size && arena->spare) {
+            block = arena->spare;
+            arena->spare = NULL;
+        } else {
+            size_t block_size = size > arena->block_size ? size : arena->block_size;
+
+            block = malloc(sizeof(*block) + block_size);
+            block->size = block_size;
+        }
+
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void * ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char * arena_strdup(struct arena * arena, const char * str) {
+    size_t length = strlen(str) + 1;
+    char * copy = arena_alloc(arena, length);
+
+    memcpy(copy, str, length);
+    return copy;
+}
+
+struct arena_mark arena_save(struct arena * arena) {
+    struct arena_mark mark = {
+        .block = arena->blocks,
+        .used = arena->blocks ? arena->blocks->used : 0,
+    };
+
+    return mark;
+}
+
+void arena_restore(struct arena * arena, struct arena_mark mark) {
+    while (arena->blocks != mark.block) {
+        struct arena_block * block = arena->blocks;
+
+        arena->blocks = block->next;
+        arena_release(arena, block);
+    }
+
+    if (arena->blocks) {
+        arena->blocks->used = mark.used;
+    }
+}
+
+void arena_reset(struct arena * arena) {
+    struct arena_mark empty = { .block = NULL, .used = 0 };
+    arena_restore(arena, empty);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct arena_block {
+    struct arena_block * next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+};
+
+struct arena {
+    size_t block_size;
+
+    struct arena_block * blocks;
+    struct arena_block * spare;
+};
+
+struct arena_mark {
+    struct arena_block * block;
+    size_t used;
+};
+
+struct arena * arena_new(size_t block_size);
+void arena_delete(struct arena * arena);
+
+void * arena_alloc(struct arena * arena, size_t size);
+char * arena_strdup(struct arena * arena, const char * str);
+
+struct arena_mark arena_save(struct arena * arena);
+void arena_restore(struct arena * arena, struct arena_mark mark);
+void arena_reset(struct arena * arena);
@@ -0,0 +1,483 @@
+#include "binary_commands.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static void binary_api_put_byte(struct buffer * buffer, uint8_t byte) {
+    *buffer_reserve(buffer, 1) = byte;
+}
+
+static void binary_api_put_varint(struct buffer * buffer, uint64_t value) {
+    uint8_t bytes[10];
+    size_t length = 0;
+
+    while (value >= 0x80) {
+        bytes[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    bytes[length++] = (uint8_t) value;
+    buffer_append(buffer, bytes, length);
+}
+
+static void binary_api_put_zigzag(struct buffer * buffer, int64_t value) {
+    binary_api_put_varint(buffer, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static void binary_api_put_double(struct buffer * buffer, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint8_t * data = buffer_reserve(buffer, sizeof(bits));
+    for (size_t i = 0; i < sizeof(bits); ++i) {
+        data[i] = (uint8_t) (bits >> (8 * i));
+    }
+}
+
+static void binary_api_put_string(struct buffer * buffer, const char * str, size_t length) {
+    binary_api_put_varint(buffer, length);
+    buffer_append(buffer, str, length);
+}
+
+void binary_api_put_object(struct buffer * buffer, struct json_object * object) {
+    switch (json_object_get_type(object)) {
+        case json_type_null:
+            binary_api_put_byte(buffer, BINARY_API_TAG_NULL);
+            break;
+
+        case json_type_boolean:
+            binary_api_put_byte(buffer, json_object_get_boolean(object) ? BINARY_API_TAG_TRUE : BINARY_API_TAG_FALSE);
+            break;
+
+        case json_type_double:
+            binary_api_put_byte(buffer, BINARY_API_TAG_NUM);
+            binary_api_put_double(buffer, json_object_get_double(object));
+            break;
+
+        case json_type_int: {
+            int64_t value = json_object_get_int64(object);
+
+            if (value < 0) {
+                binary_api_put_byte(buffer, BINARY_API_TAG_INT);
+                binary_api_put_zigzag(buffer, value);
+            } else {
+                binary_api_put_byte(buffer, BINARY_API_TAG_UINT);
+                binary_api_put_varint(buffer, json_object_get_uint64(object));
+            }
+
+            break;
+        }
+
+        case json_type_string:
+            binary_api_put_byte(buffer, BINARY_API_TAG_STR);
+            binary_api_put_string(buffer, json_object_get_string(object), json_object_get_string_len(object));
+            break;
+
+        case json_type_array: {
+            size_t amount = json_object_array_length(object);
+
+            binary_api_put_byte(buffer, BINARY_API_TAG_ARRAY);
+            binary_api_put_varint(buffer, amount);
+
+            for (size_t i = 0; i < amount; ++i) {
+                binary_api_put_object(buffer, json_object_array_get_idx(object, i));
+            }
+
+            break;
+        }
+
+        case json_type_object:
+            binary_api_put_byte(buffer, BINARY_API_TAG_OBJECT);
+            binary_api_put_varint(buffer, json_object_object_length(object));
+
+            json_object_object_foreach(object, key, val) {
+                binary_api_put_string(buffer, key, strlen(key));
+                binary_api_put_object(buffer, val);
+            }
+
+            break;
+    }
+}
+
+void binary_api_put_columns(struct buffer * buffer, unsigned int amount, const struct database_column * columns) {
+    binary_api_put_varint(buffer, amount);
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        binary_api_put_string(buffer, columns[i].name, strlen(columns[i].name));
+        binary_api_put_byte(buffer, (uint8_t) columns[i].type);
+    }
+}
+
+void binary_api_put_row(struct buffer * buffer, unsigned int amount, const struct database_column * columns,
+                        struct database_value ** values) {
+    binary_api_put_byte(buffer, 1);
+
+    uint8_t * nulls = buffer_reserve(buffer, (amount + 7) / 8);
+    size_t nulls_offset = nulls - buffer->data;
+    memset(nulls, 0, (amount + 7) / 8);
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        if (!values[i]) {
+            buffer->data[nulls_offset + i / 8] |= (uint8_t) (1 << (i % 8));
+            continue;
+        }
+
+        switch (columns[i].type) {
+            case STORAGE_COLUMN_TYPE_INT:
+                binary_api_put_zigzag(buffer, values[i]->value._int);
+                break;
+
+            case STORAGE_COLUMN_TYPE_UINT:
+                binary_api_put_varint(buffer, values[i]->value.uint);
+                break;
+
+            case STORAGE_COLUMN_TYPE_NUM:
+                binary_api_put_double(buffer, values[i]->value.num);
+                break;
+
+            case STORAGE_COLUMN_TYPE_STR:
+                binary_api_put_string(buffer, values[i]->value.str, strlen(values[i]->value.str));
+                break;
+        }
+    }
+}
+
+void binary_api_put_rows_end(struct buffer * buffer) {
+    binary_api_put_byte(buffer, 0);
+}
+
+static int binary_api_get_byte(const uint8_t * data, size_t length, size_t * offset, uint8_t * byte) {
+    if (*offset >= length) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *byte = data[(*offset)++];
+    return 0;
+}
+
+static int binary_api_get_varint(const uint8_t * data, size_t length, size_t * offset, uint64_t * value) {
+    *value = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+
+        if (binary_api_get_byte(data, length, offset, &byte) != 0) {
+            return -1;
+        }
+
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int binary_api_get_zigzag(const uint8_t * data, size_t length, size_t * offset, int64_t * value) {
+    uint64_t raw;
+
+    if (binary_api_get_varint(data, length, offset, &raw) != 0) {
+        return -1;
+    }
+
+    *value = (int64_t) (raw >> 1) ^ -(int64_t) (raw & 1);
+    return 0;
+}
+
+static int binary_api_get_double(const uint8_t * data, size_t length, size_t * offset, double * value) {
+    uint64_t bits = 0;
+
+    if (*offset > length || length - *offset < sizeof(bits)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(bits); ++i) {
+        bits |= (uint64_t) data[*offset + i] << (8 * i);
+    }
+
+    *offset += sizeof(bits);
+    memcpy(value, &bits, sizeof(bits));
+    return 0;
+}
+
+static int binary_api_get_string(const uint8_t * data, size_t length, size_t * offset, const char ** str, size_t * str_length) {
+    uint64_t size;
+
+    if (binary_api_get_varint(data, length, offset, &size) != 0) {
+        return -1;
+    }
+
+    if (size > length - *offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *str = (const char *) data + *offset;
+    *str_length = size;
+    *offset += size;
+    return 0;
+}
+
+static int binary_api_get_tagged(const uint8_t * data, size_t length, size_t * offset, struct json_object ** object,
+                                 unsigned int depth) {
+    uint8_t tag;
+
+    *object = NULL;
+
+    if (depth > BINARY_API_MAX_DEPTH || binary_api_get_byte(data, length, offset, &tag) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (tag) {
+        case BINARY_API_TAG_NULL:
+            return 0;
+
+        case BINARY_API_TAG_FALSE:
+        case BINARY_API_TAG_TRUE:
+            *object = json_object_new_boolean(tag == BINARY_API_TAG_TRUE);
+            return 0;
+
+        case BINARY_API_TAG_INT: {
+            int64_t value;
+
+            if (binary_api_get_zigzag(data, length, offset, &value) != 0) {
+                return -1;
+            }
+
+            *object = json_object_new_int64(value);
+            return 0;
+        }
+
+        case BINARY_API_TAG_UINT: {
+            uint64_t value;
+
+            if (binary_api_get_varint(data, length, offset, &value) != 0) {
+                return -1;
+            }
+
+            *object = json_object_new_uint64(value);
+            return 0;
+        }
+
+        case BINARY_API_TAG_NUM: {
+            double value;
+
+            if (binary_api_get_double(data, length, offset, &value) != 0) {
+                return -1;
+            }
+
+            *object = json_object_new_double(value);
+            return 0;
+        }
+
+        case BINARY_API_TAG_STR: {
+            const char * str;
+            size_t str_length;
+
+            if (binary_api_get_string(data, length, offset, &str, &str_length) != 0) {
+                return -1;
+            }
+
+            *object = json_object_new_string_len(str, (int) str_length);
+            return 0;
+        }
+
+        case BINARY_API_TAG_ARRAY: {
+            uint64_t amount;
+
+            if (binary_api_get_varint(data, length, offset, &amount) != 0 || amount > length - *offset) {
+                errno = EINVAL;
+                return -1;
+            }
+
+            *object = json_object_new_array_ext((int) amount);
+
+            for (uint64_t i = 0; i < amount; ++i) {
+                struct json_object * elem;
+
+                if (binary_api_get_tagged(data, length, offset, &elem, depth + 1) != 0) {
+                    json_object_put(*object);
+                    *object = NULL;
+                    return -1;
+                }
+
+                json_object_array_add(*object, elem);
+            }
+
+            return 0;
+        }
+
+        case BINARY_API_TAG_OBJECT: {
+            uint64_t amount;
+
+            if (binary_api_get_varint(data, length, offset, &amount) != 0 || amount > length - *offset) {
+                errno = EINVAL;
+                return -1;
+            }
+
+            *object = json_object_new_object();
+
+            for (uint64_t i = 0; i < amount; ++i) {
+                const char * key;
+                size_t key_length;
+                struct json_object * val;
+
+                if (binary_api_get_string(data, length, offset, &key, &key_length) != 0
+                    || binary_api_get_tagged(data, length, offset, &val, depth + 1) != 0) {
+                    json_object_put(*object);
+                    *object = NULL;
+                    return -1;
+                }
+
+                char key_string[key_length + 1];
+                memcpy(key_string, key, key_length);
+                key_string[key_length] = '\0';
+
+                json_object_object_add(*object, key_string, val);
+            }
+
+            return 0;
+        }
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+int binary_api_get_object(const uint8_t * data, size_t length, size_t * offset, struct json_object ** object) {
+    return binary_api_get_tagged(data, length, offset, object, 0);
+}
+
+static int binary_api_get_row(const uint8_t * data, size_t length, size_t * offset, const uint8_t * types,
+                              unsigned int amount, struct json_object * row) {
+    const uint8_t * nulls = data + *offset;
+
+    if ((amount + 7) / 8 > length - *offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *offset += (amount + 7) / 8;
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        struct json_object * value = NULL;
+
+        if (!(nulls[i / 8] & (1 << (i % 8)))) {
+            switch (types[i]) {
+                case STORAGE_COLUMN_TYPE_INT: {
+                    int64_t _int;
+
+                    if (binary_api_get_zigzag(data, length, offset, &_int) != 0) {
+                        return -1;
+                    }
+
+                    value = json_object_new_int64(_int);
+                    break;
+                }
+
+                case STORAGE_COLUMN_TYPE_UINT: {
+                    uint64_t uint;
+
+                    if (binary_api_get_varint(data, length, offset, &uint) != 0) {
+                        return -1;
+                    }
+
+                    value = json_object_new_uint64(uint);
+                    break;
+                }
+
+                case STORAGE_COLUMN_TYPE_NUM: {
+                    double num;
+
+                    if (binary_api_get_double(data, length, offset, &num) != 0) {
+                        return -1;
+                    }
+
+                    value = json_object_new_double(num);
+                    break;
+                }
+
+                case STORAGE_COLUMN_TYPE_STR: {
+                    const char * str;
+                    size_t str_length;
+
+                    if (binary_api_get_string(data, length, offset, &str, &str_length) != 0) {
+                        return -1;
+                    }
+
+                    value = json_object_new_string_len(str, (int) str_length);
+                    break;
+                }
+
+                default:
+                    errno = EINVAL;
+                    return -1;
+            }
+        }
+
+        json_object_array_add(row, value);
+    }
+
+    return 0;
+}
+
+int binary_api_get_table(const uint8_t * data, size_t length, size_t * offset, struct json_object * answer) {
+    uint64_t amount;
+
+    if (binary_api_get_varint(data, length, offset, &amount) != 0 || amount > length - *offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct json_object * columns = json_object_new_array_ext((int) amount);
+    struct json_object * values = json_object_new_array();
+    uint8_t * types = malloc(amount ? amount : 1);
+
+    json_object_object_add(answer, "columns", columns);
+    json_object_object_add(answer, "values", values);
+
+    for (uint64_t i = 0; i < amount; ++i) {
+        const char * name;
+        size_t name_length;
+
+        if (binary_api_get_string(data, length, offset, &name, &name_length) != 0
+            || binary_api_get_byte(data, length, offset, &types[i]) != 0) {
+            free(types);
+            return -1;
+        }
+
+        json_object_array_add(columns, json_object_new_string_len(name, (int) name_length));
+    }
+
+    while (true) {
+        uint8_t marker;
+
+        if (binary_api_get_byte(data, length, offset, &marker) != 0) {
+            free(types);
+            return -1;
+        }
+
+        if (marker == 0) {
+            break;
+        }
+
+        struct json_object * row = json_object_new_array_ext((int) amount);
+        json_object_array_add(values, row);
+
+        if (binary_api_get_row(data, length, offset, types, (unsigned int) amount, row) != 0) {
+            free(types);
+            return -1;
+        }
+    }
+
+    free(types);
+    return 0;
+}
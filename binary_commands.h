@@ -0,0 +1,32 @@
+#pragma once
+
+#include <json-c/json.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
+#include "database.h"
+
+#define BINARY_API_MAGIC ("\377BIN")
+#define BINARY_API_MAGIC_SIZE 4
+#define BINARY_API_MAX_DEPTH 32
+
+enum binary_api_tag {
+    BINARY_API_TAG_NULL = 0,
+    BINARY_API_TAG_FALSE = 1,
+    BINARY_API_TAG_TRUE = 2,
+    BINARY_API_TAG_INT = 3,
+    BINARY_API_TAG_UINT = 4,
+    BINARY_API_TAG_NUM = 5,
+    BINARY_API_TAG_STR = 6,
+    BINARY_API_TAG_ARRAY = 7,
+    BINARY_API_TAG_OBJECT = 8,
+};
+
+void binary_api_put_object(struct buffer * buffer, struct json_object * object);
+void binary_api_put_columns(struct buffer * buffer, unsigned int amount, const struct database_column * columns);
+void binary_api_put_row(struct buffer * buffer, unsigned int amount, const struct database_column * columns,
+                        struct database_value ** values);
+void binary_api_put_rows_end(struct buffer * buffer);
+
+int binary_api_get_object(const uint8_t * data, size_t length, size_t * offset, struct json_object ** object);
+int binary_api_get_table(const uint8_t * data, size_t length, size_t * offset, struct json_object * answer);
@@ -0,0 +1,37 @@
+#include "buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_INITIAL_CAPACITY 4096
+
+uint8_t * buffer_reserve(struct buffer * buffer, size_t length) {
+    if (buffer->size + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : BUFFER_INITIAL_CAPACITY;
+
+        while (capacity < buffer->size + length) {
+            capacity *= 2;
+        }
+
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+
+    uint8_t * data = buffer->data + buffer->size;
+    buffer->size += length;
+    return data;
+}
+
+void buffer_append(struct buffer * buffer, const void * data, size_t length) {
+    if (length > 0) {
+        memcpy(buffer_reserve(buffer, length), data, length);
+    }
+}
+
+void buffer_free(struct buffer * buffer) {
+    free(buffer->data);
+
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct buffer {
+    uint8_t * data;
+    size_t size;
+    size_t capacity;
+};
+
+uint8_t * buffer_reserve(struct buffer * buffer, size_t length);
+void buffer_append(struct buffer * buffer, const void * data, size_t length);
+void buffer_free(struct buffer * buffer);
@@ -10,6 +10,7 @@
 #include <X11/Xutil.h>
 
 #include "json_commands.h"
+#include "binary_commands.h"
 #include "y.tab.h"
 
 const int EDIT_FIELD_LENGTH = 150;
@@ -40,6 +41,7 @@ GC response_gc;
 
 
 bool gui_mode = true;
+bool binary_mode = false;
 char response_text[1024][1024];
 char system_message[1024]= "";
 int response_number_of_lines;
@@ -447,11 +449,7 @@ static void print_response(enum json_api_action action, struct json_object * res
             break;
 
         case JSON_API_TYPE_INSERT:
-            printf("Inserted row.\n");
-            if (gui_mode) {
-                clear_system_message();
-                strcpy(system_message, "Inserted row.");
-            }
+            print_response_with_amount(response, "inserted");
             break;
 
         case JSON_API_TYPE_DELETE:
@@ -466,47 +464,174 @@ static void print_response(enum json_api_action action, struct json_object * res
             print_response_with_amount(response, "updated");
             break;
 
+        case JSON_API_TYPE_CREATE_INDEX:
+            printf("Index was created.\n");
+            if (gui_mode) {
+                clear_system_message();
+                strcpy(system_message, "Index was created.");
+            }
+            break;
+
+        case JSON_API_TYPE_VACUUM:
+            printf("Database was compacted.\n");
+            if (gui_mode) {
+                clear_system_message();
+                strcpy(system_message, "Database was compacted.");
+            }
+            break;
+
+        case JSON_API_TYPE_DECLARE_CURSOR:
+            printf("Cursor was declared.\n");
+            if (gui_mode) {
+                clear_system_message();
+                strcpy(system_message, "Cursor was declared.");
+            }
+            break;
+
+        case JSON_API_TYPE_FETCH:
+            print_table(response);
+            break;
+
+        case JSON_API_TYPE_CLOSE_CURSOR:
+            printf("Cursor was closed.\n");
+            if (gui_mode) {
+                clear_system_message();
+                strcpy(system_message, "Cursor was closed.");
+            }
+            break;
+
+        case JSON_API_TYPE_COPY:
+            print_response_with_amount(response, "copied");
+            break;
+
         default:
             return;
     }
 }
 
-static bool process_request(int socket, struct json_object * request) {
-    const char * request_string = json_object_to_json_string_ext(request, 0);
+static bool write_fully(int socket, const void * data, size_t length) {
+    const uint8_t * cursor = data;
 
-    ssize_t wrote;
-    size_t remaining = strlen(request_string);
-    while (remaining > 0) {
-        wrote = write(socket, request_string, remaining);
+    while (length > 0) {
+        ssize_t wrote = write(socket, cursor, length);
 
         if (wrote < 0) {
             return false;
         }
 
-        request_string += wrote;
-        remaining -= wrote;
+        cursor += wrote;
+        length -= wrote;
     }
 
-    char buffer[64 * 1024];
-    ssize_t was_read = read(socket, buffer, sizeof(buffer) / sizeof(*buffer));
-    if (was_read <= 0) {
-        return false;
+    return true;
+}
+
+static bool read_fully(int socket, void * data, size_t length) {
+    uint8_t * cursor = data;
+
+    while (length > 0) {
+        ssize_t was_read = read(socket, cursor, length);
+
+        if (was_read <= 0) {
+            return false;
+        }
+
+        cursor += was_read;
+        length -= was_read;
     }
 
-    if (was_read == sizeof(buffer) / sizeof(*buffer)) {
-        buffer[sizeof(buffer) / sizeof(*buffer) - 1] = '\0';
+    return true;
+}
+
+static bool read_response(int socket, struct buffer * response) {
+    uint8_t header[JSON_API_FRAME_HEADER_SIZE];
+    uint32_t length;
+
+    do {
+        if (!read_fully(socket, header, sizeof(header))) {
+            return false;
+        }
+
+        length = json_api_get_frame_length(header);
+        if ((length & ~JSON_API_FRAME_MORE) > JSON_API_FRAME_MAX_SIZE) {
+            return false;
+        }
+
+        size_t fragment = length & ~JSON_API_FRAME_MORE;
+        if (!read_fully(socket, buffer_reserve(response, fragment), fragment)) {
+            return false;
+        }
+    } while (length & JSON_API_FRAME_MORE);
+
+    return true;
+}
+
+static struct json_object * decode_binary_response(const uint8_t * data, size_t length) {
+    size_t offset = 0;
+    struct json_object * response;
+
+    if (binary_api_get_object(data, length, &offset, &response) != 0) {
+        return NULL;
+    }
+
+    if (offset == length) {
+        return response;
+    }
+
+    struct json_object * answer;
+    if (!json_object_object_get_ex(response, "success", &answer)
+        || binary_api_get_table(data, length, &offset, answer) != 0 || offset != length) {
+        json_object_put(response);
+        return NULL;
+    }
+
+    return response;
+}
+
+static bool process_request(int socket, struct json_object * request) {
+    struct buffer buffer = {0};
+    uint8_t header[JSON_API_FRAME_HEADER_SIZE];
+
+    if (binary_mode) {
+        binary_api_put_object(&buffer, request);
     } else {
-        buffer[was_read] = '\0';
+        size_t request_length;
+        const char * request_string = json_object_to_json_string_length(request, 0, &request_length);
+
+        buffer_append(&buffer, request_string, request_length);
+    }
+
+    json_api_put_frame_header(header, (uint32_t) buffer.size);
+
+    bool sent = write_fully(socket, header, sizeof(header)) && write_fully(socket, buffer.data, buffer.size);
+    buffer.size = 0;
+
+    if (!sent || !read_response(socket, &buffer)) {
+        buffer_free(&buffer);
+        return false;
     }
 
-    enum json_tokener_error response_error;
-    struct json_object * response = json_tokener_parse_verbose(buffer, &response_error);
-    if (response_error == json_tokener_success) {
-        print_response(json_api_get_action(request), response);
+    if (binary_mode) {
+        struct json_object * response = decode_binary_response(buffer.data, buffer.size);
+
+        if (response) {
+            print_response(json_api_get_action(request), response);
+        } else {
+            printf("Bad answer: malformed binary response.\n");
+        }
     } else {
-        printf("Bad answer (%s): %s.\n", json_tokener_error_desc(response_error), buffer);
+        *buffer_reserve(&buffer, 1) = '\0';
+
+        enum json_tokener_error response_error;
+        struct json_object * response = json_tokener_parse_verbose((const char *) buffer.data, &response_error);
+        if (response_error == json_tokener_success) {
+            print_response(json_api_get_action(request), response);
+        } else {
+            printf("Bad answer (%s): %s.\n", json_tokener_error_desc(response_error), buffer.data);
+        }
     }
 
+    buffer_free(&buffer);
     return true;
 }
 
@@ -639,6 +764,15 @@ int main(int argc, char** argv) {
         printf("Incorrect argument. Specify 'cli' or 'gui' as an argument.\n");
         exit(1);
     }
+
+    if (argc > 2) {
+        if (strcmp(argv[2], "binary") != 0 && strcmp(argv[2], "json") != 0) {
+            printf("Incorrect protocol. Specify 'json' or 'binary' as the second argument.\n");
+            exit(1);
+        }
+
+        binary_mode = strcmp(argv[2], "binary") == 0;
+    }
     // create a socket
     int client_socket = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -653,6 +787,17 @@ int main(int argc, char** argv) {
         perror("There was an error making a connection to the remote socket");
         return -1;
     }
+
+    if (binary_mode) {
+        char magic[BINARY_API_MAGIC_SIZE];
+
+        if (!write_fully(client_socket, BINARY_API_MAGIC, BINARY_API_MAGIC_SIZE)
+            || !read_fully(client_socket, magic, BINARY_API_MAGIC_SIZE)
+            || memcmp(magic, BINARY_API_MAGIC, BINARY_API_MAGIC_SIZE) != 0) {
+            printf("Server does not support the binary protocol.\n");
+            return -1;
+        }
+    }
     if (strcmp(argv[1], "gui") == 0){
         XInitThreads();
         display = XOpenDisplay(NULL);
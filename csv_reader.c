@@ -0,0 +1,218 @@
+#include "csv_reader.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct csv_reader * csv_reader_new(int fd, size_t buffer_size, size_t record_limit) {
+    struct csv_reader * reader = calloc(1, sizeof(*reader));
+
+    if (!reader) {
+        return NULL;
+    }
+
+    reader->fd = fd;
+    reader->record_limit = record_limit;
+    reader->buffer.data = malloc(buffer_size);
+    reader->buffer.capacity = buffer_size;
+
+    if (!reader->buffer.data) {
+        free(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+void csv_reader_delete(struct csv_reader * reader) {
+    if (reader) {
+        free(reader->buffer.data);
+        free(reader->fields.fields);
+        free(reader->fields.quoted);
+    }
+
+    free(reader);
+}
+
+static int csv_reader_fill(struct csv_reader * reader) {
+    if (reader->buffer.begin > 0) {
+        memmove(reader->buffer.data, reader->buffer.data + reader->buffer.begin, reader->buffer.end - reader->buffer.begin);
+        reader->buffer.end -= reader->buffer.begin;
+        reader->buffer.begin = 0;
+    }
+
+    // one byte is always kept free to terminate the last field of a file without a trailing newline
+    if (reader->buffer.end + 1 >= reader->buffer.capacity) {
+        if (reader->buffer.end >= reader->record_limit) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+
+        size_t capacity = reader->buffer.capacity * 2;
+
+        if (capacity > reader->record_limit + 1) {
+            capacity = reader->record_limit + 1;
+        }
+
+        char * data = realloc(reader->buffer.data, capacity);
+
+        if (!data) {
+            return -1;
+        }
+
+        reader->buffer.data = data;
+        reader->buffer.capacity = capacity;
+    }
+
+    ssize_t length;
+    do {
+        length = read(reader->fd, reader->buffer.data + reader->buffer.end, reader->buffer.capacity - reader->buffer.end - 1);
+    } while (length < 0 && errno == EINTR);
+
+    if (length < 0) {
+        return -1;
+    }
+
+    reader->eof = length == 0;
+    reader->buffer.end += length;
+    return 0;
+}
+
+static char * csv_reader_find_end(struct csv_reader * reader) {
+    bool quoted = false;
+
+    for (char * c = reader->buffer.data + reader->buffer.begin; c < reader->buffer.data + reader->buffer.end; ++c) {
+        if (*c == '"') {
+            quoted = !quoted;
+        } else if (*c == '\n' && !quoted) {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+static int csv_reader_add_field(struct csv_reader * reader, char * field, bool quoted) {
+    if (reader->fields.amount == reader->fields.capacity) {
+        unsigned int capacity = reader->fields.capacity ? 2 * reader->fields.capacity : 16;
+        char ** fields = realloc(reader->fields.fields, sizeof(*fields) * capacity);
+
+        if (!fields) {
+            return -1;
+        }
+
+        reader->fields.fields = fields;
+
+        bool * quoted_flags = realloc(reader->fields.quoted, sizeof(*quoted_flags) * capacity);
+
+        if (!quoted_flags) {
+            return -1;
+        }
+
+        reader->fields.quoted = quoted_flags;
+        reader->fields.capacity = capacity;
+    }
+
+    reader->fields.fields[reader->fields.amount] = field;
+    reader->fields.quoted[reader->fields.amount] = quoted;
+    ++reader->fields.amount;
+    return 0;
+}
+
+static int csv_reader_split(struct csv_reader * reader, char * begin, char * end) {
+    reader->fields.amount = 0;
+
+    if (end > begin && end[-1] == '\r') {
+        --end;
+    }
+
+    for (char * c = begin; ; ++c) {
+        char * field = c;
+        bool quoted = *c == '"';
+
+        if (quoted) {
+            char * out = c++;
+
+            while (true) {
+                if (c == end) {
+                    errno = EINVAL;
+                    return -1;
+                }
+
+                if (*c == '"') {
+                    if (c + 1 < end && c[1] == '"') {
+                        *out++ = '"';
+                        c += 2;
+                        continue;
+                    }
+
+                    ++c;
+                    break;
+                }
+
+                *out++ = *c++;
+            }
+
+            if (c != end && *c != ',') {
+                errno = EINVAL;
+                return -1;
+            }
+
+            *out = '\0';
+        } else {
+            while (c != end && *c != ',') {
+                ++c;
+            }
+        }
+
+        bool last = c == end;
+        *c = '\0';
+
+        if (csv_reader_add_field(reader, field, quoted) != 0) {
+            return -1;
+        }
+
+        if (last) {
+            return 0;
+        }
+    }
+}
+
+int csv_reader_next(struct csv_reader * reader) {
+    while (true) {
+        char * end = csv_reader_find_end(reader);
+
+        if (!end && reader->eof) {
+            if (reader->buffer.begin == reader->buffer.end) {
+                return 0;
+            }
+
+            end = reader->buffer.data + reader->buffer.end;
+        }
+
+        if (!end) {
+            if (csv_reader_fill(reader) != 0) {
+                ++reader->records;
+                return -1;
+            }
+
+            continue;
+        }
+
+        char * begin = reader->buffer.data + reader->buffer.begin;
+        reader->buffer.begin = end - reader->buffer.data;
+
+        if (reader->buffer.begin < reader->buffer.end) {
+            ++reader->buffer.begin;
+        }
+
+        ++reader->records;
+
+        if (end == begin || (end == begin + 1 && *begin == '\r')) {
+            continue;
+        }
+
+        return csv_reader_split(reader, begin, end) == 0 ? 1 : -1;
+    }
+}
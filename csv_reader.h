@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct csv_reader {
+    int fd;
+    bool eof;
+    size_t record_limit;
+    unsigned long long records;
+
+    struct {
+        char * data;
+        size_t begin;
+        size_t end;
+        size_t capacity;
+    } buffer;
+
+    struct {
+        unsigned int amount;
+        unsigned int capacity;
+        char ** fields;
+        bool * quoted;
+    } fields;
+};
+
+struct csv_reader * csv_reader_new(int fd, size_t buffer_size, size_t record_limit);
+void csv_reader_delete(struct csv_reader * reader);
+
+int csv_reader_next(struct csv_reader * reader);
@@ -1,249 +1,1640 @@
-#define _LARGEFILE64_SOURCE
+#define _GNU_SOURCE
 
 #include "database.h"
+#include "predicate.h"
 
-#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
 
 #define SIGNATURE ("\xDE\xAD\xBA\xBE")
+#define SIGNATURE_VERSIONED ("\xDE\xAD\xBE\xEF")
+
+#define FORMAT_VERSION_LEGACY 1
+#define FORMAT_VERSION_INLINE_VALUES 2
+#define FORMAT_VERSION_LINKED_ROWS 3
+#define FORMAT_VERSION_SIZE_CLASSES 4
+#define FORMAT_VERSION_INDEXES 5
+#define FORMAT_VERSION FORMAT_VERSION_INDEXES
+
+#define HEADER_SIZE 256
+#define HEADER_VERSION_OFFSET 4
+#define HEADER_FIRST_TABLE_OFFSET 8
+#define HEADER_FREE_LISTS_OFFSET 16
+#define HEADER_FIRST_INDEX_OFFSET (HEADER_FREE_LISTS_OFFSET + DATABASE_SIZE_CLASSES_AMOUNT * sizeof(uint64_t))
+#define LEGACY_HEADER_FIRST_TABLE_OFFSET 4
+
+#define SIZE_CLASS_MIN_SHIFT 4
+
+#define CATALOG_INITIAL_SIZE 64
+#define JOIN_HASH_INITIAL_SIZE 64
+#define JOIN_PLAN_EXHAUSTIVE_LIMIT 12
+#define JOIN_FILTER_ARENA_BLOCK_SIZE (16 * 1024)
+
+#define INDEX_NODE_SIZE 4096
+#define INDEX_NODE_HEADER_SIZE 16
+#define INDEX_LEAF_ENTRY 2
+#define INDEX_INNER_ENTRY 3
+#define INDEX_LEAF_CAPACITY ((INDEX_NODE_SIZE - INDEX_NODE_HEADER_SIZE) / (INDEX_LEAF_ENTRY * sizeof(uint64_t)) - 1)
+#define INDEX_INNER_CAPACITY ((INDEX_NODE_SIZE - INDEX_NODE_HEADER_SIZE) / (INDEX_INNER_ENTRY * sizeof(uint64_t)) - 1)
+
+#define WAL_CHECKPOINT_SIZE (4 * 1024 * 1024)
+
+#define COMPACT_SUFFIX (".compact")
+
+static __thread int database_error = 0;
+
+static void database_fail(int error) {
+    if (database_error == 0) {
+        database_error = error ? error : EIO;
+    }
+}
+
+int database_get_error(void) {
+    return database_error;
+}
+
+void database_clear_error(void) {
+    database_error = 0;
+}
+
+static uint64_t database_read(struct database * storage, uint64_t offset, void * buf, size_t length) {
+    if (page_cache_read(storage->cache, offset, buf, length) != 0) {
+        database_fail(errno);
+    }
+
+    return offset + length;
+}
+
+static uint64_t database_write_at(struct database * storage, uint64_t offset, const void * buf, size_t length) {
+    if (page_cache_write(storage->cache, offset, buf, length) != 0) {
+        database_fail(errno);
+    }
+
+    return offset + length;
+}
+
+static unsigned int database_size_class(size_t length) {
+    unsigned int index = 0;
+
+    while (index < DATABASE_SIZE_CLASSES_AMOUNT && ((size_t) 1 << (SIZE_CLASS_MIN_SHIFT + index)) < length) {
+        ++index;
+    }
+
+    return index;
+}
+
+static uint64_t database_free_list_pointer(unsigned int index) {
+    return HEADER_FREE_LISTS_OFFSET + index * sizeof(uint64_t);
+}
+
+static uint64_t database_allocate(struct database * storage, size_t length) {
+    uint64_t offset = storage->cache->size;
+
+    if (storage->version < FORMAT_VERSION_SIZE_CLASSES) {
+        return offset;
+    }
+
+    unsigned int index = database_size_class(length);
+    if (index == DATABASE_SIZE_CLASSES_AMOUNT) {
+        return offset;
+    }
+
+    if (storage->free_lists[index] != 0) {
+        offset = storage->free_lists[index];
+
+        database_read(storage, offset, &storage->free_lists[index], sizeof(storage->free_lists[index]));
+        database_write_at(storage, database_free_list_pointer(index), &storage->free_lists[index], sizeof(storage->free_lists[index]));
+        return offset;
+    }
+
+    uint8_t zero = 0;
+    database_write_at(storage, offset + ((size_t) 1 << (SIZE_CLASS_MIN_SHIFT + index)) - 1, &zero, sizeof(zero));
+    return offset;
+}
+
+static void database_free(struct database * storage, uint64_t offset, size_t length) {
+    if (storage->version < FORMAT_VERSION_SIZE_CLASSES || offset == 0) {
+        return;
+    }
+
+    unsigned int index = database_size_class(length);
+    if (index == DATABASE_SIZE_CLASSES_AMOUNT) {
+        return;
+    }
+
+    pthread_mutex_lock(&storage->locks.allocator);
+    database_write_at(storage, offset, &storage->free_lists[index], sizeof(storage->free_lists[index]));
+    storage->free_lists[index] = offset;
+    database_write_at(storage, database_free_list_pointer(index), &offset, sizeof(offset));
+    pthread_mutex_unlock(&storage->locks.allocator);
+}
+
+static uint64_t database_write(struct database * storage, const void * buf, size_t length) {
+    pthread_mutex_lock(&storage->locks.allocator);
+    uint64_t offset = database_allocate(storage, length);
+
+    database_write_at(storage, offset, buf, length);
+    pthread_mutex_unlock(&storage->locks.allocator);
+    return offset;
+}
+
+static struct database * database_new(int fd, const struct database_options * options, bool mapped) {
+    struct page_cache * cache;
+
+    if (mapped) {
+        cache = page_cache_new_mapped(fd, options->cache_size);
+    } else {
+        cache = page_cache_new(fd, options->cache_size);
+    }
+
+    if (!cache) {
+        return NULL;
+    }
+
+    struct wal * wal = NULL;
+    if (options->wal_fd >= 0) {
+        wal = wal_open(options->wal_fd);
+        cache->wal = wal;
+
+        if (!wal || page_cache_checkpoint(cache) != 0) {
+            wal_delete(wal);
+            page_cache_delete(cache);
+            return NULL;
+        }
+    }
+
+    struct database * storage = malloc(sizeof(*storage));
+
+    storage->fd = fd;
+    storage->version = FORMAT_VERSION;
+    storage->first_table = 0;
+    storage->first_index = 0;
+    memset(storage->free_lists, 0, sizeof(storage->free_lists));
+    storage->options = *options;
+    storage->cache = cache;
+    storage->wal = wal;
+
+    storage->catalog.amount = 0;
+    storage->catalog.size = CATALOG_INITIAL_SIZE;
+    storage->catalog.buckets = calloc(CATALOG_INITIAL_SIZE, sizeof(*storage->catalog.buckets));
+
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+
+    pthread_rwlock_init(&storage->locks.schema, &attributes);
+    pthread_rwlock_init(&storage->locks.commit, &attributes);
+    pthread_mutex_init(&storage->locks.allocator, NULL);
+    pthread_mutex_init(&storage->locks.catalog, NULL);
+
+    pthread_rwlockattr_destroy(&attributes);
+    return storage;
+}
+
+static uint64_t database_catalog_hash(const char * name) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *name; ++name) {
+        hash = (hash ^ (uint8_t) *name) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static struct database_table ** database_catalog_bucket(struct database * storage, const char * name) {
+    return &storage->catalog.buckets[database_catalog_hash(name) % storage->catalog.size];
+}
+
+static struct database_table * database_catalog_lookup(struct database * storage, const char * name) {
+    for (struct database_table * table = *database_catalog_bucket(storage, name); table; table = table->next_in_bucket) {
+        if (strcmp(table->name, name) == 0) {
+            return table;
+        }
+    }
+
+    return NULL;
+}
+
+static void database_catalog_grow(struct database * storage) {
+    unsigned int size = storage->catalog.size;
+    struct database_table ** buckets = storage->catalog.buckets;
+
+    storage->catalog.size = 2 * size;
+    storage->catalog.buckets = calloc(storage->catalog.size, sizeof(*storage->catalog.buckets));
+
+    for (unsigned int i = 0; i < size; ++i) {
+        struct database_table * table = buckets[i];
+
+        while (table) {
+            struct database_table * next = table->next_in_bucket;
+            struct database_table ** bucket = database_catalog_bucket(storage, table->name);
+
+            table->next_in_bucket = *bucket;
+            *bucket = table;
+            table = next;
+        }
+    }
+
+    free(buckets);
+}
+
+static void database_catalog_insert(struct database * storage, struct database_table * table) {
+    if (storage->catalog.amount >= storage->catalog.size) {
+        database_catalog_grow(storage);
+    }
+
+    struct database_table ** bucket = database_catalog_bucket(storage, table->name);
+    table->next_in_bucket = *bucket;
+    *bucket = table;
+    ++storage->catalog.amount;
+
+    pthread_rwlock_init(&table->lock, NULL);
+    table->generation = 0;
+    table->cataloged = true;
+
+    pthread_mutex_init(&table->statistics.lock, NULL);
+    table->statistics.ready = false;
+    table->statistics.rows = 0;
+    table->statistics.columns = NULL;
+}
+
+static void database_catalog_erase(struct database * storage, struct database_table * table) {
+    struct database_table ** link = database_catalog_bucket(storage, table->name);
+
+    while (*link != table) {
+        link = &(*link)->next_in_bucket;
+    }
+
+    *link = table->next_in_bucket;
+    table->next_in_bucket = NULL;
+    --storage->catalog.amount;
+
+    ++table->generation;
+}
+
+static uint64_t database_first_table_pointer(struct database * storage) {
+    if (storage->version == FORMAT_VERSION_LEGACY) {
+        return LEGACY_HEADER_FIRST_TABLE_OFFSET;
+    }
+
+    return HEADER_FIRST_TABLE_OFFSET;
+}
+
+static uint64_t database_first_index_pointer(struct database * storage) {
+    return HEADER_FIRST_INDEX_OFFSET;
+}
+
+struct database * database_init(int fd, const struct database_options * options) {
+    struct database * storage = database_new(fd, options, false);
+
+    if (!storage) {
+        return NULL;
+    }
+
+    uint8_t header[HEADER_SIZE] = { 0 };
+    memcpy(header, SIGNATURE_VERSIONED, 4);
+    memcpy(header + HEADER_VERSION_OFFSET, &storage->version, sizeof(storage->version));
+    memcpy(header + HEADER_FIRST_TABLE_OFFSET, &storage->first_table, sizeof(storage->first_table));
+
+    database_write_at(storage, 0, header, sizeof(header));
+    database_flush(storage);
+    return storage;
+}
+
+static void * database_memory(struct arena * arena, size_t size) {
+    return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+static char * database_read_string(struct database * storage, uint64_t * offset, struct arena * arena) {
+    uint16_t length;
+
+    *offset = database_read(storage, *offset, &length, sizeof(length));
+
+    char * str = database_memory(arena, sizeof(int8_t) * (length + 1));
+    *offset = database_read(storage, *offset, str, length);
+    str[length] = '\0';
 
-struct database * database_init(int fd) {
-    lseek64(fd, 0, SEEK_SET);
+    return str;
+}
+
+static struct database_table * database_read_table(struct database * storage, uint64_t pointer) {
+    uint64_t offset = pointer;
+
+    struct database_table * table = malloc(sizeof(*table));
+    table->storage = storage;
+    table->refs = 1;
+    table->position = pointer;
+    table->indexes = NULL;
+    table->next_in_bucket = NULL;
+    table->cataloged = false;
+
+    offset = database_read(storage, offset, &table->next, sizeof(table->next));
+    offset = database_read(storage, offset, &table->first_row, sizeof(table->first_row));
+    table->name = database_read_string(storage, &offset, NULL);
+
+    offset = database_read(storage, offset, &table->columns.amount, sizeof(table->columns.amount));
+    table->columns.columns = malloc(sizeof(*table->columns.columns) * table->columns.amount);
+
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        table->columns.columns[i].name = database_read_string(storage, &offset, NULL);
+
+        uint8_t type;
+        offset = database_read(storage, offset, &type, sizeof(type));
+        table->columns.columns[i].type = (enum database_column_type) type;
+    }
+
+    return table;
+}
+
+static int database_read_header(struct database * storage) {
+    char sign[4];
+    if (storage->cache->size < 4 + sizeof(storage->first_table)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    database_read(storage, 0, sign, 4);
+    if (memcmp(sign, SIGNATURE, 4) == 0) {
+        storage->version = FORMAT_VERSION_LEGACY;
+    } else if (memcmp(sign, SIGNATURE_VERSIONED, 4) == 0) {
+        database_read(storage, HEADER_VERSION_OFFSET, &storage->version, sizeof(storage->version));
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (storage->version > FORMAT_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    database_read(storage, database_first_table_pointer(storage), &storage->first_table, sizeof(storage->first_table));
+
+    memset(storage->free_lists, 0, sizeof(storage->free_lists));
+    if (storage->version >= FORMAT_VERSION_SIZE_CLASSES) {
+        database_read(storage, HEADER_FREE_LISTS_OFFSET, storage->free_lists, sizeof(storage->free_lists));
+    }
+
+    storage->first_index = 0;
+    if (storage->version >= FORMAT_VERSION_INDEXES) {
+        database_read(storage, database_first_index_pointer(storage), &storage->first_index, sizeof(storage->first_index));
+    }
+
+    return 0;
+}
+
+int database_flush(struct database * storage) {
+    pthread_rwlock_wrlock(&storage->locks.commit);
+    int ret = page_cache_flush(storage->cache);
+    pthread_rwlock_unlock(&storage->locks.commit);
+
+    return ret;
+}
+
+int database_sync(struct database * storage) {
+    if (!storage->wal) {
+        return fdatasync(storage->fd);
+    }
+
+    if (wal_sync(storage->wal, wal_committed(storage->wal)) != 0) {
+        return -1;
+    }
+
+    if (wal_length(storage->wal) < WAL_CHECKPOINT_SIZE) {
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&storage->locks.commit);
+
+    int ret = page_cache_flush(storage->cache);
+    if (ret == 0) {
+        ret = wal_sync(storage->wal, wal_committed(storage->wal));
+    }
+
+    if (ret == 0 && wal_length(storage->wal) >= WAL_CHECKPOINT_SIZE) {
+        ret = page_cache_checkpoint(storage->cache);
+    }
+
+    pthread_rwlock_unlock(&storage->locks.commit);
+    return ret;
+}
+
+void database_lock(struct database * storage, bool exclusive) {
+    if (exclusive) {
+        pthread_rwlock_wrlock(&storage->locks.schema);
+    } else {
+        pthread_rwlock_rdlock(&storage->locks.schema);
+    }
+}
+
+void database_unlock(struct database * storage) {
+    pthread_rwlock_unlock(&storage->locks.schema);
+}
+
+void database_table_lock(struct database_table * table, bool exclusive) {
+    if (!exclusive) {
+        pthread_rwlock_rdlock(&table->lock);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&table->lock);
+    pthread_rwlock_rdlock(&table->storage->locks.commit);
+}
+
+void database_table_unlock(struct database_table * table, bool exclusive) {
+    if (exclusive) {
+        pthread_rwlock_unlock(&table->storage->locks.commit);
+    }
+
+    pthread_rwlock_unlock(&table->lock);
+}
+
+void delete_database(struct database * storage) {
+    if (storage) {
+        database_flush(storage);
+        database_sync(storage);
+        page_cache_checkpoint(storage->cache);
+        page_cache_delete(storage->cache);
+        wal_delete(storage->wal);
+
+        for (unsigned int i = 0; i < storage->catalog.size; ++i) {
+            struct database_table * table = storage->catalog.buckets[i];
+
+            while (table) {
+                struct database_table * next = table->next_in_bucket;
+                database_table_delete(table);
+                table = next;
+            }
+        }
+
+        free(storage->catalog.buckets);
+
+        pthread_rwlock_destroy(&storage->locks.schema);
+        pthread_rwlock_destroy(&storage->locks.commit);
+        pthread_mutex_destroy(&storage->locks.allocator);
+        pthread_mutex_destroy(&storage->locks.catalog);
+    }
+
+    free(storage);
+}
+
+static void database_index_delete(struct database_index * index) {
+    if (index) {
+        free(index->name);
+    }
+
+    free(index);
+}
+
+void database_table_delete(struct database_table * table) {
+    if (table) {
+        pthread_mutex_lock(&table->storage->locks.catalog);
+        unsigned int refs = --table->refs;
+        pthread_mutex_unlock(&table->storage->locks.catalog);
+
+        if (refs > 0) {
+            return;
+        }
+    }
+
+    if (table) {
+        if (table->cataloged) {
+            pthread_rwlock_destroy(&table->lock);
+            pthread_mutex_destroy(&table->statistics.lock);
+            free(table->statistics.columns);
+        }
+
+        while (table->indexes) {
+            struct database_index * next = table->indexes->next;
+            database_index_delete(table->indexes);
+            table->indexes = next;
+        }
+
+        free(table->name);
+
+        for (uint16_t i = 0; i < table->columns.amount; ++i) {
+            free(table->columns.columns[i].name);
+        }
+
+        free(table->columns.columns);
+    }
+
+    free(table);
+}
+
+struct database_table * database_find_table(struct database * storage, const char * name) {
+    pthread_mutex_lock(&storage->locks.catalog);
+    struct database_table * table = database_catalog_lookup(storage, name);
+
+    if (table) {
+        ++table->refs;
+    }
+
+    pthread_mutex_unlock(&storage->locks.catalog);
+    return table;
+}
+
+static uint64_t database_write_string(struct database * storage, const char * str) {
+    uint16_t length = strlen(str);
+
+    uint8_t * buffer = malloc(sizeof(length) + length);
+    memcpy(buffer, &length, sizeof(length));
+    memcpy(buffer + sizeof(length), str, length);
+
+    uint64_t ret = database_write(storage, buffer, sizeof(length) + length);
+    free(buffer);
+    return ret;
+}
+
+static void database_free_string(struct database * storage, uint64_t offset) {
+    if (storage->version < FORMAT_VERSION_SIZE_CLASSES || offset == 0) {
+        return;
+    }
+
+    uint16_t length;
+    database_read(storage, offset, &length, sizeof(length));
+    database_free(storage, offset, sizeof(length) + length);
+}
+
+static size_t database_table_record_size(struct database_table * table) {
+    size_t size = sizeof(table->next) + sizeof(table->first_row) + sizeof(uint16_t) + strlen(table->name)
+        + sizeof(table->columns.amount);
+
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        size += sizeof(uint16_t) + strlen(table->columns.columns[i].name) + sizeof(uint8_t);
+    }
+
+    return size;
+}
+
+static uint8_t * database_put_string(uint8_t * buffer, const char * str) {
+    uint16_t length = strlen(str);
 
-    write(fd, SIGNATURE, 4);
+    memcpy(buffer, &length, sizeof(length));
+    memcpy(buffer + sizeof(length), str, length);
+    return buffer + sizeof(length) + length;
+}
+
+void database_table_add(struct database_table * table) {
+    if (database_catalog_lookup(table->storage, table->name) != NULL) {
+        errno = EINVAL;
+        return;
+    }
+
+    table->next = table->storage->first_table;
+
+    size_t size = database_table_record_size(table);
+    uint8_t * buffer = malloc(size);
+    uint8_t * cursor = buffer;
+
+    memcpy(cursor, &table->next, sizeof(table->next));
+    cursor += sizeof(table->next);
+    memcpy(cursor, &table->first_row, sizeof(table->first_row));
+    cursor += sizeof(table->first_row);
+    cursor = database_put_string(cursor, table->name);
+    memcpy(cursor, &table->columns.amount, sizeof(table->columns.amount));
+    cursor += sizeof(table->columns.amount);
+
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        cursor = database_put_string(cursor, table->columns.columns[i].name);
+        *cursor++ = (uint8_t) table->columns.columns[i].type;
+    }
+
+    table->position = database_write(table->storage, buffer, size);
+    table->storage->first_table = table->position;
+    free(buffer);
+
+    ++table->refs;
+    database_catalog_insert(table->storage, table);
+
+    database_write_at(table->storage, database_first_table_pointer(table->storage), &table->position, sizeof(table->position));
+}
+
+struct database_index_node {
+    uint8_t leaf;
+    uint8_t reserved;
+    uint16_t amount;
+    uint32_t padding;
+    uint64_t link;
+    uint64_t entries[(INDEX_NODE_SIZE - INDEX_NODE_HEADER_SIZE) / sizeof(uint64_t)];
+};
+
+struct database_index_split {
+    bool happened;
+    uint64_t key;
+    uint64_t row;
+    uint64_t child;
+};
+
+static int database_value_compare(const struct database_value * a, const struct database_value * b) {
+    if (a->type == STORAGE_COLUMN_TYPE_STR || b->type == STORAGE_COLUMN_TYPE_STR) {
+        int ret = strcmp(a->value.str, b->value.str);
+        return (ret > 0) - (ret < 0);
+    }
+
+    if (a->type != STORAGE_COLUMN_TYPE_NUM && b->type != STORAGE_COLUMN_TYPE_NUM) {
+        bool a_negative = a->type == STORAGE_COLUMN_TYPE_INT && a->value._int < 0;
+        bool b_negative = b->type == STORAGE_COLUMN_TYPE_INT && b->value._int < 0;
+
+        if (a_negative != b_negative) {
+            return a_negative ? -1 : 1;
+        }
+
+        if (a_negative) {
+            return (a->value._int > b->value._int) - (a->value._int < b->value._int);
+        }
+
+        uint64_t x = a->type == STORAGE_COLUMN_TYPE_INT ? (uint64_t) a->value._int : a->value.uint;
+        uint64_t y = b->type == STORAGE_COLUMN_TYPE_INT ? (uint64_t) b->value._int : b->value.uint;
+        return (x > y) - (x < y);
+    }
+
+    double x = a->type == STORAGE_COLUMN_TYPE_NUM ? a->value.num
+        : a->type == STORAGE_COLUMN_TYPE_INT ? (double) a->value._int : (double) a->value.uint;
+    double y = b->type == STORAGE_COLUMN_TYPE_NUM ? b->value.num
+        : b->type == STORAGE_COLUMN_TYPE_INT ? (double) b->value._int : (double) b->value.uint;
+    return (x > y) - (x < y);
+}
+
+static enum database_column_type database_index_type(struct database_index * index) {
+    return index->table->columns.columns[index->column].type;
+}
+
+static int database_index_compare_key(struct database_index * index, uint64_t key, const struct database_value * value) {
+    struct database_value stored = { .type = database_index_type(index) };
+
+    if (stored.type == STORAGE_COLUMN_TYPE_STR) {
+        stored.value.str = database_read_string(index->table->storage, &key, NULL);
+
+        int ret = database_value_compare(&stored, value);
+        free(stored.value.str);
+        return ret;
+    }
+
+    memcpy(&stored.value, &key, sizeof(key));
+    return database_value_compare(&stored, value);
+}
+
+static int database_index_compare_entry(struct database_index * index, const uint64_t * entry,
+                                        const struct database_value * value, uint64_t row) {
+    int ret = database_index_compare_key(index, entry[0], value);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    return (entry[1] > row) - (entry[1] < row);
+}
+
+static uint64_t database_index_make_key(struct database_index * index, const struct database_value * value) {
+    if (value->type == STORAGE_COLUMN_TYPE_STR) {
+        return database_write_string(index->table->storage, value->value.str);
+    }
+
+    uint64_t key;
+    memcpy(&key, &value->value, sizeof(key));
+    return key;
+}
+
+static uint64_t database_index_copy_key(struct database_index * index, uint64_t key) {
+    if (database_index_type(index) != STORAGE_COLUMN_TYPE_STR) {
+        return key;
+    }
+
+    char * str = database_read_string(index->table->storage, &key, NULL);
+    uint64_t copy = database_write_string(index->table->storage, str);
+
+    free(str);
+    return copy;
+}
+
+static void database_index_read_node(struct database_index * index, uint64_t position, struct database_index_node * node) {
+    database_read(index->table->storage, position, node, sizeof(*node));
+}
+
+static void database_index_write_node(struct database_index * index, uint64_t position, const struct database_index_node * node) {
+    database_write_at(index->table->storage, position, node, sizeof(*node));
+}
+
+static uint64_t database_index_new_node(struct database_index * index, const struct database_index_node * node) {
+    return database_write(index->table->storage, node, sizeof(*node));
+}
+
+static uint16_t database_index_leaf_search(struct database_index * index, struct database_index_node * node,
+                                           const struct database_value * value, uint64_t row) {
+    uint16_t low = 0, high = node->amount;
+
+    while (low < high) {
+        uint16_t middle = (low + high) / 2;
+
+        if (database_index_compare_entry(index, node->entries + middle * INDEX_LEAF_ENTRY, value, row) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static uint16_t database_index_inner_search(struct database_index * index, struct database_index_node * node,
+                                            const struct database_value * value, uint64_t row) {
+    uint16_t low = 0, high = node->amount;
+
+    while (low < high) {
+        uint16_t middle = (low + high) / 2;
+
+        if (database_index_compare_entry(index, node->entries + middle * INDEX_INNER_ENTRY, value, row) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static uint64_t database_index_child(struct database_index_node * node, uint16_t index) {
+    return index == 0 ? node->link : node->entries[(index - 1) * INDEX_INNER_ENTRY + 2];
+}
+
+static struct database_index_split database_index_insert_into(struct database_index * index, uint64_t position,
+                                                              const struct database_value * value, uint64_t row) {
+    struct database_index_split split = { .happened = false };
+    struct database_index_node node;
+    database_index_read_node(index, position, &node);
+
+    uint16_t at;
+    size_t entry_size;
+
+    if (node.leaf) {
+        entry_size = INDEX_LEAF_ENTRY;
+        at = database_index_leaf_search(index, &node, value, row);
+
+        memmove(node.entries + (at + 1) * entry_size, node.entries + at * entry_size,
+                (node.amount - at) * entry_size * sizeof(uint64_t));
+        node.entries[at * entry_size] = database_index_make_key(index, value);
+        node.entries[at * entry_size + 1] = row;
+    } else {
+        entry_size = INDEX_INNER_ENTRY;
+        at = database_index_inner_search(index, &node, value, row);
+
+        struct database_index_split child = database_index_insert_into(index, database_index_child(&node, at), value, row);
+        if (!child.happened) {
+            return split;
+        }
+
+        memmove(node.entries + (at + 1) * entry_size, node.entries + at * entry_size,
+                (node.amount - at) * entry_size * sizeof(uint64_t));
+        node.entries[at * entry_size] = child.key;
+        node.entries[at * entry_size + 1] = child.row;
+        node.entries[at * entry_size + 2] = child.child;
+    }
+
+    ++node.amount;
+
+    if (node.amount <= (node.leaf ? INDEX_LEAF_CAPACITY : INDEX_INNER_CAPACITY)) {
+        database_index_write_node(index, position, &node);
+        return split;
+    }
+
+    struct database_index_node right = { .leaf = node.leaf };
+    uint16_t middle = node.amount / 2;
+
+    if (node.leaf) {
+        right.amount = node.amount - middle;
+        right.link = node.link;
+        memcpy(right.entries, node.entries + middle * entry_size, right.amount * entry_size * sizeof(uint64_t));
+
+        split.key = database_index_copy_key(index, right.entries[0]);
+        split.row = right.entries[1];
+    } else {
+        right.amount = node.amount - middle - 1;
+        right.link = node.entries[middle * entry_size + 2];
+        memcpy(right.entries, node.entries + (middle + 1) * entry_size, right.amount * entry_size * sizeof(uint64_t));
+
+        split.key = node.entries[middle * entry_size];
+        split.row = node.entries[middle * entry_size + 1];
+    }
+
+    node.amount = middle;
+    split.happened = true;
+    split.child = database_index_new_node(index, &right);
+
+    if (node.leaf) {
+        node.link = split.child;
+    }
+
+    database_index_write_node(index, position, &node);
+    return split;
+}
+
+static void database_index_write_root(struct database_index * index) {
+    database_write_at(index->table->storage, index->position + sizeof(uint64_t), &index->root, sizeof(index->root));
+}
+
+static void database_index_insert(struct database_index * index, const struct database_value * value, uint64_t row) {
+    struct database_index_split split = database_index_insert_into(index, index->root, value, row);
+
+    if (!split.happened) {
+        return;
+    }
+
+    struct database_index_node root = { .leaf = false, .amount = 1, .link = index->root };
+    root.entries[0] = split.key;
+    root.entries[1] = split.row;
+    root.entries[2] = split.child;
+
+    index->root = database_index_new_node(index, &root);
+    database_index_write_root(index);
+}
+
+static void database_index_remove(struct database_index * index, const struct database_value * value, uint64_t row) {
+    struct database_index_node node;
+    uint64_t position = index->root;
+
+    database_index_read_node(index, position, &node);
+    while (!node.leaf) {
+        position = database_index_child(&node, database_index_inner_search(index, &node, value, row));
+        database_index_read_node(index, position, &node);
+    }
+
+    uint16_t at = database_index_leaf_search(index, &node, value, row);
+    if (at == node.amount || node.entries[at * INDEX_LEAF_ENTRY + 1] != row) {
+        return;
+    }
+
+    if (database_index_type(index) == STORAGE_COLUMN_TYPE_STR) {
+        database_free_string(index->table->storage, node.entries[at * INDEX_LEAF_ENTRY]);
+    }
+
+    --node.amount;
+    memmove(node.entries + at * INDEX_LEAF_ENTRY, node.entries + (at + 1) * INDEX_LEAF_ENTRY,
+            (node.amount - at) * INDEX_LEAF_ENTRY * sizeof(uint64_t));
+    database_index_write_node(index, position, &node);
+}
+
+static uint64_t * database_index_collect(struct database_index * index, const struct database_range * range, size_t * amount) {
+    struct database_index_node node;
+    database_index_read_node(index, index->root, &node);
+
+    while (!node.leaf) {
+        uint16_t at = 0;
+
+        if (range->lower) {
+            uint16_t high = node.amount;
+
+            while (at < high) {
+                uint16_t middle = (at + high) / 2;
+
+                if (database_index_compare_key(index, node.entries[middle * INDEX_INNER_ENTRY], range->lower) < 0) {
+                    at = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+        }
+
+        database_index_read_node(index, database_index_child(&node, at), &node);
+    }
+
+    size_t capacity = 16;
+    uint64_t * positions = malloc(sizeof(*positions) * capacity);
+    *amount = 0;
+
+    for (;;) {
+        for (uint16_t i = 0; i < node.amount; ++i) {
+            uint64_t * entry = node.entries + i * INDEX_LEAF_ENTRY;
+
+            if (range->lower) {
+                int ret = database_index_compare_key(index, entry[0], range->lower);
+
+                if (ret < 0 || (ret == 0 && !range->lower_inclusive)) {
+                    continue;
+                }
+            }
+
+            if (range->upper) {
+                int ret = database_index_compare_key(index, entry[0], range->upper);
+
+                if (ret > 0 || (ret == 0 && !range->upper_inclusive)) {
+                    return positions;
+                }
+            }
+
+            if (*amount == capacity) {
+                capacity *= 2;
+                positions = realloc(positions, sizeof(*positions) * capacity);
+            }
+
+            positions[(*amount)++] = entry[1];
+        }
+
+        if (node.link == 0) {
+            return positions;
+        }
+
+        database_index_read_node(index, node.link, &node);
+    }
+}
+
+static void database_index_free_node(struct database_index * index, uint64_t position) {
+    struct database_index_node node;
+    database_index_read_node(index, position, &node);
+
+    bool strings = database_index_type(index) == STORAGE_COLUMN_TYPE_STR;
+    size_t entry_size = node.leaf ? INDEX_LEAF_ENTRY : INDEX_INNER_ENTRY;
+
+    for (uint16_t i = 0; i < node.amount; ++i) {
+        if (strings) {
+            database_free_string(index->table->storage, node.entries[i * entry_size]);
+        }
+
+        if (!node.leaf) {
+            database_index_free_node(index, node.entries[i * entry_size + 2]);
+        }
+    }
+
+    if (!node.leaf) {
+        database_index_free_node(index, node.link);
+    }
+
+    database_free(index->table->storage, position, sizeof(node));
+}
+
+static size_t database_index_record_size(struct database_index * index) {
+    return sizeof(uint64_t) + sizeof(index->root) + sizeof(index->column) + sizeof(uint16_t) + strlen(index->name)
+        + sizeof(uint16_t) + strlen(index->table->name);
+}
+
+static void database_index_drop(struct database_index * index) {
+    struct database * storage = index->table->storage;
+    uint64_t pointer = database_first_index_pointer(storage);
+
+    for (;;) {
+        uint64_t next;
+        database_read(storage, pointer, &next, sizeof(next));
+
+        if (next == index->position) {
+            break;
+        }
+
+        pointer = next;
+    }
+
+    uint64_t next;
+    database_read(storage, index->position, &next, sizeof(next));
+    database_write_at(storage, pointer, &next, sizeof(next));
+
+    if (pointer == database_first_index_pointer(storage)) {
+        storage->first_index = next;
+    }
+
+    database_index_free_node(index, index->root);
+    database_free(storage, index->position, database_index_record_size(index));
+}
+
+struct database_index * database_table_find_index(struct database_table * table, uint16_t column) {
+    for (struct database_index * index = table->indexes; index; index = index->next) {
+        if (index->column == column) {
+            return index;
+        }
+    }
+
+    return NULL;
+}
+
+static bool database_index_name_taken(struct database * storage, const char * name) {
+    for (unsigned int i = 0; i < storage->catalog.size; ++i) {
+        for (struct database_table * table = storage->catalog.buckets[i]; table; table = table->next_in_bucket) {
+            for (struct database_index * index = table->indexes; index; index = index->next) {
+                if (strcmp(index->name, name) == 0) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+int database_index_add(struct database_table * table, const char * name, uint16_t column) {
+    struct database * storage = table->storage;
+
+    if (storage->version < FORMAT_VERSION_INDEXES) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if (column >= table->columns.amount || database_table_find_index(table, column) != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (database_index_name_taken(storage, name)) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    struct database_index * index = malloc(sizeof(*index));
+    index->table = table;
+    index->column = column;
+    index->name = strdup(name);
+
+    struct database_index_node root = { .leaf = true };
+    index->root = database_index_new_node(index, &root);
+
+    size_t size = database_index_record_size(index);
+    uint8_t * buffer = malloc(size);
+    uint8_t * cursor = buffer;
+
+    memcpy(cursor, &storage->first_index, sizeof(storage->first_index));
+    cursor += sizeof(storage->first_index);
+    memcpy(cursor, &index->root, sizeof(index->root));
+    cursor += sizeof(index->root);
+    memcpy(cursor, &index->column, sizeof(index->column));
+    cursor += sizeof(index->column);
+    cursor = database_put_string(cursor, index->name);
+    database_put_string(cursor, table->name);
+
+    index->position = database_write(storage, buffer, size);
+    free(buffer);
+
+    storage->first_index = index->position;
+    database_write_at(storage, database_first_index_pointer(storage), &index->position, sizeof(index->position));
+
+    index->next = table->indexes;
+    table->indexes = index;
+
+    for (struct database_row * row = database_table_get_first_row(table); row; row = database_row_next(row)) {
+        struct database_value * value = database_row_get_value(row, column, NULL);
+
+        if (value) {
+            database_index_insert(index, value, row->position);
+            database_value_delete(value);
+        }
+    }
+
+    return 0;
+}
+
+static void database_load_indexes(struct database * storage) {
+    for (uint64_t pointer = storage->first_index; pointer; ) {
+        uint64_t offset = pointer;
+        struct database_index * index = malloc(sizeof(*index));
+
+        index->position = pointer;
+        offset = database_read(storage, offset, &pointer, sizeof(pointer));
+        offset = database_read(storage, offset, &index->root, sizeof(index->root));
+        offset = database_read(storage, offset, &index->column, sizeof(index->column));
+        index->name = database_read_string(storage, &offset, NULL);
+
+        char * table_name = database_read_string(storage, &offset, NULL);
+        index->table = database_catalog_lookup(storage, table_name);
+        free(table_name);
+
+        if (!index->table) {
+            database_index_delete(index);
+            continue;
+        }
+
+        index->next = index->table->indexes;
+        index->table->indexes = index;
+    }
+}
+
+static struct database * database_load(int fd, const struct database_options * options, bool mapped) {
+    struct database * storage = database_new(fd, options, mapped);
+
+    if (!storage) {
+        return NULL;
+    }
+
+    database_clear_error();
+
+    if (database_read_header(storage) != 0) {
+        delete_database(storage);
+        return NULL;
+    }
+
+    for (uint64_t pointer = storage->first_table; pointer; ) {
+        struct database_table * table = database_read_table(storage, pointer);
+
+        database_catalog_insert(storage, table);
+        pointer = table->next;
+    }
+
+    database_load_indexes(storage);
+
+    if (database_error != 0) {
+        int error = database_error;
+        database_clear_error();
+
+        delete_database(storage);
+        errno = error;
+        return NULL;
+    }
+
+    return storage;
+}
+
+struct database * database_open(int fd, const struct database_options * options) {
+    return database_load(fd, options, false);
+}
+
+struct database * database_open_mapped(int fd, const struct database_options * options) {
+    return database_load(fd, options, true);
+}
+
+static uint16_t database_row_null_bitmap_size(struct database_table * table) {
+    return (table->columns.amount + 7) / 8;
+}
+
+static uint64_t database_row_header_size(struct database * storage) {
+    if (storage->version >= FORMAT_VERSION_LINKED_ROWS) {
+        return 2 * sizeof(uint64_t);
+    }
+
+    return sizeof(uint64_t);
+}
+
+static uint64_t database_row_slot_offset(struct database_row * row, uint16_t index) {
+    if (row->table->storage->version == FORMAT_VERSION_LEGACY) {
+        return row->position + (1 + index) * sizeof(uint64_t);
+    }
+
+    return row->position + database_row_header_size(row->table->storage) + database_row_null_bitmap_size(row->table)
+        + index * sizeof(uint64_t);
+}
+
+static size_t database_row_size(struct database_table * table) {
+    if (table->storage->version == FORMAT_VERSION_LEGACY) {
+        return (1 + table->columns.amount) * sizeof(uint64_t);
+    }
+
+    return database_row_header_size(table->storage) + database_row_null_bitmap_size(table)
+        + table->columns.amount * sizeof(uint64_t);
+}
+
+static void database_row_set_value_legacy(struct database_row * row, uint16_t index, struct database_value * value) {
+    uint64_t pointer = 0;
+
+    if (value) {
+        switch (value->type) {
+            case STORAGE_COLUMN_TYPE_INT:
+                pointer = database_write(row->table->storage, &value->value._int, sizeof(value->value._int));
+                break;
+
+            case STORAGE_COLUMN_TYPE_UINT:
+                pointer = database_write(row->table->storage, &value->value.uint, sizeof(value->value.uint));
+                break;
+
+            case STORAGE_COLUMN_TYPE_NUM:
+                pointer = database_write(row->table->storage, &value->value.num, sizeof(value->value.num));
+                break;
+
+            case STORAGE_COLUMN_TYPE_STR:
+                pointer = database_write_string(row->table->storage, value->value.str);
+                break;
+        }
+    }
+
+    database_write_at(row->table->storage, database_row_slot_offset(row, index), &pointer, sizeof(pointer));
+}
+
+static uint64_t database_value_to_slot(struct database * storage, struct database_value * value) {
+    uint64_t slot = 0;
+
+    switch (value->type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            memcpy(&slot, &value->value._int, sizeof(slot));
+            break;
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            memcpy(&slot, &value->value.uint, sizeof(slot));
+            break;
+
+        case STORAGE_COLUMN_TYPE_NUM:
+            memcpy(&slot, &value->value.num, sizeof(slot));
+            break;
+
+        case STORAGE_COLUMN_TYPE_STR:
+            slot = database_write_string(storage, value->value.str);
+            break;
+    }
+
+    return slot;
+}
+
+static uint8_t * database_row_buffer_new(struct database_table * table) {
+    uint8_t * buffer = calloc(database_row_size(table), 1);
+
+    memcpy(buffer, &table->first_row, sizeof(table->first_row));
+    memset(buffer + database_row_header_size(table->storage), 0xFF, database_row_null_bitmap_size(table));
+    return buffer;
+}
+
+static void database_row_buffer_put_values(struct database_table * table, uint8_t * buffer, struct database_value ** values) {
+    uint8_t * bitmap = buffer + database_row_header_size(table->storage);
+    uint8_t * slots = bitmap + database_row_null_bitmap_size(table);
+
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        if (values[i]) {
+            uint64_t slot = database_value_to_slot(table->storage, values[i]);
+
+            memcpy(slots + i * sizeof(slot), &slot, sizeof(slot));
+            bitmap[i / 8] &= ~(1 << (i % 8));
+        }
+    }
+}
+
+static void database_row_index_values(struct database_table * table, struct database_value ** values, uint64_t position) {
+    for (struct database_index * index = table->indexes; index; index = index->next) {
+        if (values[index->column]) {
+            database_index_insert(index, values[index->column], position);
+        }
+    }
+}
+
+static void database_statistics_count(struct database_table * table, uint16_t column, const struct database_value * value, int delta) {
+    struct database_column_statistics * statistics = &table->statistics.columns[column];
+
+    if (!value) {
+        statistics->nulls += delta;
+        return;
+    }
+
+    uint64_t hash = database_value_hash(value);
+    statistics->buckets[(hash ^ (hash >> 32)) % DATABASE_STATISTICS_BUCKETS] += delta;
+}
+
+static void database_statistics_add_row(struct database_table * table, struct database_value ** values) {
+    if (!table->statistics.ready) {
+        return;
+    }
+
+    ++table->statistics.rows;
+
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        database_statistics_count(table, i, values[i], 1);
+    }
+}
+
+static void database_statistics_remove_row(struct database_row * row) {
+    struct database_table * table = row->table;
+
+    if (!table->statistics.ready) {
+        return;
+    }
 
-    uint64_t p = 0;
-    write(fd, &p, sizeof(p));
+    --table->statistics.rows;
 
-    struct database * storage = malloc(sizeof(*storage));
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        struct database_value * value = database_row_get_value(row, i, NULL);
 
-    storage->fd = fd;
-    storage->first_table = 0;
-    return storage;
+        database_statistics_count(table, i, value, -1);
+        database_value_delete(value);
+    }
 }
 
-static char * database_read_string(int fd) {
-    uint16_t length;
-
-    read(fd, &length, sizeof(length));
+static void database_statistics_prepare(struct database_table * table) {
+    pthread_mutex_lock(&table->statistics.lock);
 
-    char * str = malloc(sizeof(int8_t) * (length + 1));
-    read(fd, str, length);
-    str[length] = '\0';
+    if (!table->statistics.ready) {
+        table->statistics.rows = 0;
+        table->statistics.columns = calloc(table->columns.amount, sizeof(*table->statistics.columns));
 
-    return str;
-}
+        for (struct database_row * row = database_table_get_first_row(table); row; row = database_row_next(row)) {
+            ++table->statistics.rows;
 
-struct database * database_open(int fd) {
-    lseek64(fd, 0, SEEK_SET);
+            for (uint16_t i = 0; i < table->columns.amount; ++i) {
+                struct database_value * value = database_row_get_value(row, i, NULL);
 
-    char sign[4];
-    if (read(fd, sign, 4) != 4) {
-        errno = EINVAL;
-        return NULL;
-    }
+                database_statistics_count(table, i, value, 1);
+                database_value_delete(value);
+            }
+        }
 
-    if (memcmp(sign, SIGNATURE, 4) != 0) {
-        errno = EINVAL;
-        return NULL;
+        table->statistics.ready = true;
     }
 
-    struct database * storage = malloc(sizeof(*storage));
-    storage->fd = fd;
-
-    read(fd, &storage->first_table, sizeof(storage->first_table));
-    return storage;
+    pthread_mutex_unlock(&table->statistics.lock);
 }
 
-
-void delete_database(struct database * storage) {
-    free(storage);
+uint64_t database_table_estimate_rows(struct database_table * table) {
+    database_statistics_prepare(table);
+    return table->statistics.rows;
 }
 
-void database_table_delete(struct database_table * table) {
-    if (table) {
-        free(table->name);
+uint64_t database_table_estimate_distinct(struct database_table * table, uint16_t column) {
+    database_statistics_prepare(table);
 
-        for (uint16_t i = 0; i < table->columns.amount; ++i) {
-            free(table->columns.columns[i].name);
+    struct database_column_statistics * statistics = &table->statistics.columns[column];
+    uint64_t values = table->statistics.rows - statistics->nulls;
+    unsigned int empty = 0;
+
+    for (unsigned int i = 0; i < DATABASE_STATISTICS_BUCKETS; ++i) {
+        if (statistics->buckets[i] == 0) {
+            ++empty;
         }
+    }
 
-        free(table->columns.columns);
+    if (empty == 0) {
+        return values;
     }
 
-    free(table);
+    double estimate = -DATABASE_STATISTICS_BUCKETS * log((double) empty / DATABASE_STATISTICS_BUCKETS);
+    uint64_t distinct = (uint64_t) (estimate + 0.5);
+
+    if (distinct == 0 && values > 0) {
+        return 1;
+    }
+
+    return distinct < values ? distinct : values;
 }
 
-struct database_table * database_find_table(struct database * storage, const char * name) {
-    uint64_t pointer = storage->first_table;
+static struct database_row * database_table_append_row(struct database_table * table, const uint8_t * buffer) {
+    struct database_row * row = calloc(1, sizeof(*row));
 
-    while (pointer) {
-        lseek64(storage->fd, (off64_t) pointer, SEEK_SET);
+    row->table = table;
+    row->next = table->first_row;
+    row->position = database_write(table->storage, buffer, database_row_size(table));
 
-        uint64_t next, first_row;
-        read(storage->fd, &next, sizeof(next));
-        read(storage->fd, &first_row, sizeof(first_row));
+    if (table->storage->version >= FORMAT_VERSION_LINKED_ROWS && row->next != 0) {
+        database_write_at(table->storage, row->next + sizeof(uint64_t), &row->position, sizeof(row->position));
+    }
 
-        char * table_name = database_read_string(storage->fd);
-        if (strcmp(table_name, name) != 0) {
-            free(table_name);
-            pointer = next;
-            continue;
-        }
+    table->first_row = row->position;
+    database_write_at(table->storage, table->position + sizeof(uint64_t), &table->first_row, sizeof(table->first_row));
+    return row;
+}
 
-        struct database_table * table = malloc(sizeof(*table));
-        table->storage = storage;
-        table->position = pointer;
-        table->next = next;
-        table->first_row = first_row;
-        table->name = table_name;
+struct database_row * database_table_add_row(struct database_table * table) {
+    if (table->storage->version == FORMAT_VERSION_LEGACY) {
+        struct database_row * row = calloc(1, sizeof(*row));
 
-        read(storage->fd, &table->columns.amount, sizeof(table->columns.amount));
-        table->columns.columns = malloc(sizeof(*table->columns.columns) * table->columns.amount);
+        row->table = table;
+        row->next = table->first_row;
+        row->position = database_write(table->storage, &row->next, sizeof(row->next));
 
+        uint64_t null = 0;
         for (uint16_t i = 0; i < table->columns.amount; ++i) {
-            table->columns.columns[i].name = database_read_string(storage->fd);
-
-            uint8_t type;
-            read(storage->fd, &type, sizeof(type));
-            table->columns.columns[i].type = (enum database_column_type) type;
+            database_write(table->storage, &null, sizeof(null));
         }
 
-        return table;
+        table->first_row = row->position;
+        database_write_at(table->storage, table->position + sizeof(uint64_t), &table->first_row, sizeof(table->first_row));
+        return row;
     }
 
-    return NULL;
-}
+    uint8_t * buffer = database_row_buffer_new(table);
+    struct database_row * row = database_table_append_row(table, buffer);
 
-static uint64_t database_write(int fd, void * buf, size_t length) {
-    uint64_t offset = lseek64(fd, 0, SEEK_END);
-    write(fd, buf, length);
-    return offset;
+    free(buffer);
+    return row;
 }
 
-static uint64_t database_write_string(int fd, const char * str) {
-    uint16_t length = strlen(str);
+struct database_row * database_table_insert_row(struct database_table * table, struct database_value ** values) {
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        if (values[i] && values[i]->type != table->columns.columns[i].type) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
 
-    uint64_t ret = database_write(fd, &length, sizeof(length));
-    write(fd, str, length);
-    return ret;
-}
+    if (table->storage->version == FORMAT_VERSION_LEGACY) {
+        struct database_row * row = database_table_add_row(table);
 
-void database_table_add(struct database_table * table) {
-    struct database_table * another_table = database_find_table(table->storage, table->name);
+        for (uint16_t i = 0; i < table->columns.amount; ++i) {
+            if (values[i]) {
+                database_row_set_value_legacy(row, i, values[i]);
+            }
+        }
 
-    if (another_table != NULL) {
-        database_table_delete(another_table);
-        errno = EINVAL;
-        return;
+        database_statistics_add_row(table, values);
+        return row;
     }
 
-    table->next = table->storage->first_table;
-    table->position = database_write(table->storage->fd, &table->next, sizeof(table->next));
-    table->storage->first_table = table->position;
+    uint8_t * buffer = database_row_buffer_new(table);
+    database_row_buffer_put_values(table, buffer, values);
 
-    write(table->storage->fd, &table->first_row, sizeof(table->first_row));
-    database_write_string(table->storage->fd, table->name);
-    write(table->storage->fd, &table->columns.amount, sizeof(table->columns.amount));
+    struct database_row * row = database_table_append_row(table, buffer);
+    free(buffer);
 
-    for (uint16_t i = 0; i < table->columns.amount; ++i) {
-        database_write_string(table->storage->fd, table->columns.columns[i].name);
+    database_row_index_values(table, values, row->position);
+    database_statistics_add_row(table, values);
+    return row;
+}
 
-        uint8_t type = table->columns.columns[i].type;
-        write(table->storage->fd, &type, sizeof(type));
+int database_table_insert_rows(struct database_table * table, size_t amount, struct database_value *** values) {
+    for (size_t i = 0; i < amount; ++i) {
+        for (uint16_t j = 0; j < table->columns.amount; ++j) {
+            if (values[i][j] && values[i][j]->type != table->columns.columns[j].type) {
+                errno = EINVAL;
+                return -1;
+            }
+        }
     }
 
-    lseek64(table->storage->fd, 4, SEEK_SET);
-    write(table->storage->fd, &table->position, sizeof(table->position));
-}
+    if (table->storage->version == FORMAT_VERSION_LEGACY) {
+        for (size_t i = 0; i < amount; ++i) {
+            database_row_delete(database_table_insert_row(table, values[i]));
+        }
 
-void database_table_remove(struct database_table * table) {
-    uint64_t pointer = table->storage->first_table;
+        return 0;
+    }
 
-    while (pointer) {
-        lseek64(table->storage->fd, (off64_t) pointer, SEEK_SET);
+    size_t size = database_row_size(table);
+    uint8_t * buffer = malloc(size);
+    uint64_t first_row = table->first_row;
 
-        uint64_t next;
-        read(table->storage->fd, &next, sizeof(next));
+    for (size_t i = 0; i < amount; ++i) {
+        memset(buffer, 0, size);
+        memcpy(buffer, &first_row, sizeof(first_row));
+        memset(buffer + database_row_header_size(table->storage), 0xFF, database_row_null_bitmap_size(table));
+        database_row_buffer_put_values(table, buffer, values[i]);
 
-        if (next == table->position) {
-            break;
+        uint64_t position = database_write(table->storage, buffer, size);
+
+        if (table->storage->version >= FORMAT_VERSION_LINKED_ROWS && first_row != 0) {
+            database_write_at(table->storage, first_row + sizeof(uint64_t), &position, sizeof(position));
         }
 
-        pointer = next;
+        database_row_index_values(table, values[i], position);
+        database_statistics_add_row(table, values[i]);
+        first_row = position;
     }
 
-    if (pointer == 0) {
-        pointer = 4;
-        table->storage->first_table = table->next;
+    free(buffer);
+
+    if (first_row != table->first_row) {
+        table->first_row = first_row;
+        database_write_at(table->storage, table->position + sizeof(uint64_t), &table->first_row, sizeof(table->first_row));
     }
 
-    lseek64(table->storage->fd, (off64_t) pointer, SEEK_SET);
-    write(table->storage->fd, &table->next, sizeof(table->next));
+    return 0;
 }
 
-struct database_row * database_table_add_row(struct database_table * table) {
-    struct database_row * row = malloc(sizeof(*row));
+struct database_row * database_table_get_first_row(struct database_table * table) {
+    if (table->first_row == 0) {
+        return NULL;
+    }
 
+    struct database_row * row = calloc(1, sizeof(*row));
+    row->position = table->first_row;
     row->table = table;
-    row->next = table->first_row;
-    row->position = database_write(table->storage->fd, &row->next, sizeof(row->next));
-    table->first_row = row->position;
 
-    uint64_t null = 0;
-    for (uint16_t i = 0; i < table->columns.amount; ++i) {
-        write(table->storage->fd, &null, sizeof(null));
-    }
+    database_read(table->storage, row->position, &row->next, sizeof(row->next));
 
-    lseek64(table->storage->fd, (off64_t) (table->position + sizeof(uint64_t)), SEEK_SET);
-    write(table->storage->fd, &table->first_row, sizeof(table->first_row));
     return row;
 }
 
-struct database_row * database_table_get_first_row(struct database_table * table) {
-    if (table->first_row == 0) {
+static struct database_row * database_table_select(struct database_table * table, uint64_t * positions, size_t amount) {
+    if (amount == 0) {
+        free(positions);
         return NULL;
     }
 
-    struct database_row * row = malloc(sizeof(*row));
-    row->position = table->first_row;
+    struct database_row * row = calloc(1, sizeof(*row));
     row->table = table;
+    row->position = positions[0];
+    row->selection.amount = amount;
+    row->selection.positions = positions;
 
-    lseek64(table->storage->fd, (off64_t) row->position, SEEK_SET);
-    read(table->storage->fd, &row->next, sizeof(row->next));
-
+    database_read(table->storage, row->position, &row->next, sizeof(row->next));
     return row;
 }
 
+struct database_row * database_table_scan(struct database_table * table, const struct database_range * range) {
+    if (!range || !range->index) {
+        return database_table_get_first_row(table);
+    }
+
+    size_t amount;
+    uint64_t * positions = database_index_collect(range->index, range, &amount);
+
+    return database_table_select(table, positions, amount);
+}
+
 struct database_row * database_row_next(struct database_row * row) {
-    row->position = row->next;
+    if (row->selection.positions) {
+        if (++row->selection.current == row->selection.amount) {
+            database_row_delete(row);
+            return NULL;
+        }
 
-    if (row->next == 0) {
-        free(row);
-        return NULL;
+        row->position = row->selection.positions[row->selection.current];
+    } else {
+        row->position = row->next;
+
+        if (row->next == 0) {
+            database_row_delete(row);
+            return NULL;
+        }
     }
 
-    lseek64(row->table->storage->fd, (off64_t) row->position, SEEK_SET);
-    read(row->table->storage->fd, &row->next, sizeof(row->next));
+    database_read(row->table->storage, row->position, &row->next, sizeof(row->next));
     return row;
 }
 
 
 void database_row_delete(struct database_row * row) {
+    if (row) {
+        free(row->selection.positions);
+    }
+
     free(row);
 }
 
+static void database_row_set_null(struct database_row * row, uint16_t index, bool null) {
+    uint64_t offset = row->position + database_row_header_size(row->table->storage) + index / 8;
+    uint8_t mask = 1 << (index % 8);
+
+    uint8_t byte;
+    database_read(row->table->storage, offset, &byte, sizeof(byte));
+
+    uint8_t updated = null ? (byte | mask) : (byte & ~mask);
+    if (updated != byte) {
+        database_write_at(row->table->storage, offset, &updated, sizeof(updated));
+    }
+}
+
+static bool database_row_is_null(struct database_row * row, uint16_t index) {
+    uint8_t byte;
+    database_read(row->table->storage, row->position + database_row_header_size(row->table->storage) + index / 8, &byte, sizeof(byte));
+
+    return (byte & (1 << (index % 8))) != 0;
+}
+
+static void database_row_free_string(struct database_row * row, uint16_t index) {
+    if (row->table->storage->version < FORMAT_VERSION_SIZE_CLASSES
+        || row->table->columns.columns[index].type != STORAGE_COLUMN_TYPE_STR || database_row_is_null(row, index)) {
+        return;
+    }
+
+    uint64_t slot;
+    database_read(row->table->storage, database_row_slot_offset(row, index), &slot, sizeof(slot));
+    database_free_string(row->table->storage, slot);
+}
+
+static void database_row_release(struct database_row * row) {
+    for (uint16_t i = 0; i < row->table->columns.amount; ++i) {
+        database_row_free_string(row, i);
+    }
+
+    database_free(row->table->storage, row->position, database_row_size(row->table));
+}
+
+static void database_row_unlink(struct database_row * row) {
+    uint64_t prev;
+    database_read(row->table->storage, row->position + sizeof(uint64_t), &prev, sizeof(prev));
+
+    if (prev == 0) {
+        row->table->first_row = row->next;
+        database_write_at(row->table->storage, row->table->position + sizeof(uint64_t), &row->next, sizeof(row->next));
+    } else {
+        database_write_at(row->table->storage, prev, &row->next, sizeof(row->next));
+    }
+
+    if (row->next != 0) {
+        database_write_at(row->table->storage, row->next + sizeof(uint64_t), &prev, sizeof(prev));
+    }
+}
+
+static void database_row_unindex(struct database_row * row, struct database_index * index) {
+    struct database_value * value = database_row_get_value(row, index->column, NULL);
+
+    if (value) {
+        database_index_remove(index, value, row->position);
+        database_value_delete(value);
+    }
+}
+
 void database_row_remove(struct database_row * row) {
+    ++row->table->generation;
+    database_statistics_remove_row(row);
+
+    for (struct database_index * index = row->table->indexes; index; index = index->next) {
+        database_row_unindex(row, index);
+    }
+
+    if (row->table->storage->version >= FORMAT_VERSION_LINKED_ROWS) {
+        database_row_unlink(row);
+        database_row_release(row);
+        return;
+    }
+
     uint64_t pointer = row->table->first_row;
 
     while (pointer) {
-        lseek64(row->table->storage->fd, (off64_t) pointer, SEEK_SET);
-
         uint64_t next;
-        read(row->table->storage->fd, &next, sizeof(next));
+        database_read(row->table->storage, pointer, &next, sizeof(next));
 
         if (next == row->position) {
             break;
@@ -257,8 +1648,52 @@ void database_row_remove(struct database_row * row) {
         row->table->first_row = row->next;
     }
 
-    lseek64(row->table->storage->fd, (off64_t) pointer, SEEK_SET);
-    write(row->table->storage->fd, &row->next, sizeof(row->next));
+    database_write_at(row->table->storage, pointer, &row->next, sizeof(row->next));
+}
+
+void database_table_remove(struct database_table * table) {
+    struct database * storage = table->storage;
+    struct database_table * previous = NULL;
+
+    for (unsigned int i = 0; i < storage->catalog.size && !previous; ++i) {
+        for (struct database_table * another = storage->catalog.buckets[i]; another; another = another->next_in_bucket) {
+            if (another->next == table->position) {
+                previous = another;
+                break;
+            }
+        }
+    }
+
+    uint64_t pointer;
+    if (previous) {
+        pointer = previous->position;
+        previous->next = table->next;
+    } else {
+        pointer = database_first_table_pointer(storage);
+        storage->first_table = table->next;
+    }
+
+    database_write_at(storage, pointer, &table->next, sizeof(table->next));
+
+    while (table->indexes) {
+        struct database_index * next = table->indexes->next;
+
+        database_index_drop(table->indexes);
+        database_index_delete(table->indexes);
+        table->indexes = next;
+    }
+
+    if (storage->version >= FORMAT_VERSION_SIZE_CLASSES) {
+        for (struct database_row * row = database_table_get_first_row(table); row; row = database_row_next(row)) {
+            database_row_release(row);
+        }
+
+        table->first_row = 0;
+        database_free(storage, table->position, database_table_record_size(table));
+    }
+
+    database_catalog_erase(storage, table);
+    database_table_delete(table);
 }
 
 void database_row_set_value(struct database_row * row, uint16_t index, struct database_value * value) {
@@ -267,76 +1702,268 @@ void database_row_set_value(struct database_row * row, uint16_t index, struct da
         return;
     }
 
-    uint64_t pointer = 0;
+    if (value && row->table->columns.columns[index].type != value->type) {
+        errno = EINVAL;
+        return;
+    }
+
+    if (row->table->statistics.ready) {
+        struct database_value * previous = database_row_get_value(row, index, NULL);
+
+        database_statistics_count(row->table, index, previous, -1);
+        database_statistics_count(row->table, index, value, 1);
+        database_value_delete(previous);
+    }
+
+    if (row->table->storage->version == FORMAT_VERSION_LEGACY) {
+        database_row_set_value_legacy(row, index, value);
+        return;
+    }
+
+    struct database_index * column_index = database_table_find_index(row->table, index);
+    if (column_index) {
+        database_row_unindex(row, column_index);
+    }
+
+    database_row_free_string(row, index);
+
+    if (!value) {
+        database_row_set_null(row, index, true);
+        return;
+    }
+
+    uint64_t slot = database_value_to_slot(row->table->storage, value);
+    database_write_at(row->table->storage, database_row_slot_offset(row, index), &slot, sizeof(slot));
+    database_row_set_null(row, index, false);
+
+    if (column_index) {
+        database_index_insert(column_index, value, row->position);
+    }
+}
 
+struct database_value * database_row_get_value(struct database_row * row, uint16_t index, struct arena * arena) {
+    if (index >= row->table->columns.amount) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    bool legacy = row->table->storage->version == FORMAT_VERSION_LEGACY;
+    if (!legacy && database_row_is_null(row, index)) {
+        return NULL;
+    }
+
+    uint64_t slot;
+    database_read(row->table->storage, database_row_slot_offset(row, index), &slot, sizeof(slot));
+
+    if (legacy && slot == 0) {
+        return NULL;
+    }
+
+    struct database_value * value = database_memory(arena, sizeof(*value));
+    value->type = row->table->columns.columns[index].type;
+
+    if (value->type == STORAGE_COLUMN_TYPE_STR) {
+        value->value.str = database_read_string(row->table->storage, &slot, arena);
+        return value;
+    }
+
+    if (legacy) {
+        database_read(row->table->storage, slot, &slot, sizeof(slot));
+    }
+
+    switch (value->type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            memcpy(&value->value._int, &slot, sizeof(value->value._int));
+            break;
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            memcpy(&value->value.uint, &slot, sizeof(value->value.uint));
+            break;
+
+        case STORAGE_COLUMN_TYPE_NUM:
+            memcpy(&value->value.num, &slot, sizeof(value->value.num));
+            break;
+
+        default:
+            break;
+    }
+
+    return value;
+}
+
+void database_value_destroy(struct database_value value) {
+    if (value.type == STORAGE_COLUMN_TYPE_STR) {
+        free(value.value.str);
+    }
+}
+
+void database_value_delete(struct database_value * value) {
     if (value) {
-        if (row->table->columns.columns[index].type != value->type) {
-            errno = EINVAL;
-            return;
+        database_value_destroy(*value);
+    }
+
+    free(value);
+}
+
+static uint64_t * database_collect_chain(struct database * storage, uint64_t pointer, size_t * amount) {
+    size_t capacity = 16;
+    uint64_t * chain = malloc(sizeof(*chain) * capacity);
+
+    *amount = 0;
+    while (pointer) {
+        if (*amount == capacity) {
+            capacity *= 2;
+            chain = realloc(chain, sizeof(*chain) * capacity);
         }
 
-        switch (value->type) {
-            case STORAGE_COLUMN_TYPE_INT:
-                pointer = database_write(row->table->storage->fd, &value->value._int, sizeof(value->value._int));
-                break;
+        chain[(*amount)++] = pointer;
+        database_read(storage, pointer, &pointer, sizeof(pointer));
+    }
 
-            case STORAGE_COLUMN_TYPE_UINT:
-                pointer = database_write(row->table->storage->fd, &value->value.uint, sizeof(value->value.uint));
-                break;
+    return chain;
+}
+
+static void database_compact_table(struct database_table * table, struct database * target) {
+    struct database_table * copy = malloc(sizeof(*copy));
+    copy->storage = target;
+    copy->refs = 1;
+    copy->position = 0;
+    copy->next = 0;
+    copy->first_row = 0;
+    copy->name = strdup(table->name);
+    copy->columns.amount = table->columns.amount;
+    copy->columns.columns = malloc(sizeof(*copy->columns.columns) * table->columns.amount);
+    copy->indexes = NULL;
+    copy->next_in_bucket = NULL;
+    copy->cataloged = false;
+
+    for (uint16_t i = 0; i < table->columns.amount; ++i) {
+        copy->columns.columns[i].name = strdup(table->columns.columns[i].name);
+        copy->columns.columns[i].type = table->columns.columns[i].type;
+    }
+
+    database_table_add(copy);
+
+    for (struct database_index * index = table->indexes; index; index = index->next) {
+        database_index_add(copy, index->name, index->column);
+    }
+
+    size_t amount;
+    uint64_t * rows = database_collect_chain(table->storage, table->first_row, &amount);
+
+    for (size_t i = amount; i > 0; --i) {
+        struct database_row source = { .table = table, .position = rows[i - 1] };
+        struct database_value * values[table->columns.amount];
+
+        for (uint16_t j = 0; j < table->columns.amount; ++j) {
+            values[j] = database_row_get_value(&source, j, NULL);
+        }
 
-            case STORAGE_COLUMN_TYPE_NUM:
-                pointer = database_write(row->table->storage->fd, &value->value.num, sizeof(value->value.num));
-                break;
+        database_row_delete(database_table_insert_row(copy, values));
 
-            case STORAGE_COLUMN_TYPE_STR:
-                pointer = database_write_string(row->table->storage->fd, value->value.str);
-                break;
+        for (uint16_t j = 0; j < table->columns.amount; ++j) {
+            database_value_delete(values[j]);
         }
     }
 
-    lseek64(row->table->storage->fd, (off64_t) (row->position + (1 + index) * sizeof(uint64_t)), SEEK_SET);
-    write(row->table->storage->fd, &pointer, sizeof(pointer));
+    free(rows);
+    database_table_delete(copy);
 }
 
-struct database_value * database_row_get_value(struct database_row * row, uint16_t index) {
-    if (index >= row->table->columns.amount) {
-        errno = EINVAL;
-        return NULL;
+int database_compact(struct database * storage, const char * path) {
+    if (database_flush(storage) != 0 || database_sync(storage) != 0 || page_cache_checkpoint(storage->cache) != 0) {
+        return -1;
     }
 
-    lseek64(row->table->storage->fd, (off64_t) (row->position + (1 + index) * sizeof(uint64_t)), SEEK_SET);
+    char * temp_path = malloc(strlen(path) + sizeof(COMPACT_SUFFIX));
+    strcpy(temp_path, path);
+    strcat(temp_path, COMPACT_SUFFIX);
 
-    uint64_t pointer;
-    read(row->table->storage->fd, &pointer, sizeof(pointer));
+    int fd = open(temp_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        free(temp_path);
+        return -1;
+    }
 
-    if (pointer == 0) {
-        return NULL;
+    struct database_options options = storage->options;
+    options.wal_fd = -1;
+
+    struct database * target = database_init(fd, &options);
+    if (!target) {
+        close(fd);
+        unlink(temp_path);
+        free(temp_path);
+        return -1;
     }
 
-    lseek64(row->table->storage->fd, (off64_t) pointer, SEEK_SET);
+    size_t amount;
+    uint64_t * tables = database_collect_chain(storage, storage->first_table, &amount);
 
-    struct database_value * value = malloc(sizeof(*value));
-    value->type = row->table->columns.columns[index].type;
+    for (size_t i = amount; i > 0; --i) {
+        struct database_table * table = database_read_table(storage, tables[i - 1]);
+        database_compact_table(database_catalog_lookup(storage, table->name), target);
+        database_table_delete(table);
+    }
 
-    switch (value->type) {
-        case STORAGE_COLUMN_TYPE_INT:
-            read(row->table->storage->fd, &value->value._int, sizeof(value->value._int));
-            break;
+    free(tables);
 
-        case STORAGE_COLUMN_TYPE_UINT:
-            read(row->table->storage->fd, &value->value.uint, sizeof(value->value.uint));
-            break;
+    struct page_cache * cache = NULL;
+    int previous = -1;
 
-        case STORAGE_COLUMN_TYPE_NUM:
-            read(row->table->storage->fd, &value->value.num, sizeof(value->value.num));
-            break;
+    if (database_flush(target) == 0 && fsync(fd) == 0) {
+        if (storage->cache->mapping.enabled) {
+            cache = page_cache_new_mapped(fd, storage->options.cache_size);
+        } else {
+            cache = page_cache_new(fd, storage->options.cache_size);
+        }
+    }
 
-        case STORAGE_COLUMN_TYPE_STR:
-            value->value.str = database_read_string(row->table->storage->fd);
-            break;
+    if (cache) {
+        previous = dup(storage->fd);
     }
 
-    return value;
+    if (previous < 0 || dup2(fd, storage->fd) < 0 || rename(temp_path, path) != 0) {
+        if (previous >= 0) {
+            dup2(previous, storage->fd);
+            close(previous);
+        }
+
+        page_cache_delete(cache);
+        delete_database(target);
+        close(fd);
+        unlink(temp_path);
+        free(temp_path);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < storage->catalog.size; ++i) {
+        for (struct database_table * table = storage->catalog.buckets[i]; table; table = table->next_in_bucket) {
+            struct database_table * moved = database_catalog_lookup(target, table->name);
+
+            table->position = moved->position;
+            table->next = moved->next;
+            table->first_row = moved->first_row;
+            ++table->generation;
+
+            for (struct database_index * index = table->indexes; index; index = index->next) {
+                struct database_index * rebuilt = database_table_find_index(moved, index->column);
+
+                index->position = rebuilt->position;
+                index->root = rebuilt->root;
+            }
+        }
+    }
+
+    delete_database(target);
+    close(previous);
+    close(fd);
+    free(temp_path);
+
+    cache->fd = storage->fd;
+    cache->wal = storage->wal;
+    page_cache_delete(storage->cache);
+    storage->cache = cache;
+    return database_read_header(storage);
 }
 
 struct database_joined_table * database_joined_table_new(unsigned int amount) {
@@ -344,6 +1971,12 @@ struct database_joined_table * database_joined_table_new(unsigned int amount) {
 
     table->tables.amount = amount;
     table->tables.tables = calloc(amount, sizeof(*table->tables.tables));
+    table->tables.order = malloc(sizeof(*table->tables.order) * amount);
+    table->arena = arena_new(JOIN_FILTER_ARENA_BLOCK_SIZE);
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        table->tables.order[i] = i;
+    }
 
     return table;
 }
@@ -380,18 +2013,6 @@ const char * database_column_type_to_string(enum database_column_type type) {
     }
 }
 
-void database_joined_table_delete(struct database_joined_table * table) {
-    if (table) {
-        for (int i = 0; i < table->tables.amount; ++i) {
-            database_table_delete(table->tables.tables[i].table);
-        }
-
-        free(table->tables.tables);
-    }
-
-    free(table);
-}
-
 struct database_column database_joined_table_get_column(struct database_joined_table * table, uint16_t index) {
     for (int i = 0; i < table->tables.amount; ++i) {
         if (index < table->tables.tables[i].table->columns.amount) {
@@ -404,7 +2025,7 @@ struct database_column database_joined_table_get_column(struct database_joined_t
     abort();
 }
 
-static bool database_value_equals(struct database_value * a, struct database_value * b) {
+bool database_value_equals(const struct database_value * a, const struct database_value * b) {
     if (a == NULL || b == NULL) {
         return a == b;
     }
@@ -476,6 +2097,299 @@ static bool database_value_equals(struct database_value * a, struct database_val
     }
 }
 
+uint64_t database_value_hash(const struct database_value * value) {
+    if (!value) {
+        return 0;
+    }
+
+    double number;
+
+    switch (value->type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            number = (double) value->value._int;
+            break;
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            number = (double) value->value.uint;
+            break;
+
+        case STORAGE_COLUMN_TYPE_NUM:
+            number = value->value.num == 0 ? 0 : value->value.num;
+            break;
+
+        case STORAGE_COLUMN_TYPE_STR:
+            return database_catalog_hash(value->value.str);
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return bits;
+}
+
+static void database_join_hash_grow(struct database_join_hash * hash) {
+    size_t size = hash->size;
+    struct database_join_entry ** buckets = hash->buckets;
+
+    hash->size = 2 * size;
+    hash->buckets = calloc(hash->size, sizeof(*hash->buckets));
+
+    for (size_t i = 0; i < size; ++i) {
+        struct database_join_entry * entry = buckets[i];
+
+        while (entry) {
+            struct database_join_entry * next = entry->next_in_bucket;
+            struct database_join_entry ** bucket = &hash->buckets[entry->hash % hash->size];
+
+            entry->next_in_bucket = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    free(buckets);
+}
+
+static struct database_join_entry * database_join_hash_lookup(struct database_join_hash * hash, const struct database_value * key, uint64_t key_hash) {
+    for (struct database_join_entry * entry = hash->buckets[key_hash % hash->size]; entry; entry = entry->next_in_bucket) {
+        if (entry->hash == key_hash && database_value_equals(entry->key, key)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void database_join_hash_insert(struct database_join_hash * hash, const struct database_value * key, uint64_t position) {
+    uint64_t key_hash = database_value_hash(key);
+    struct database_join_entry * entry = database_join_hash_lookup(hash, key, key_hash);
+
+    if (!entry) {
+        if (hash->amount >= hash->size) {
+            database_join_hash_grow(hash);
+        }
+
+        struct database_join_entry ** bucket = &hash->buckets[key_hash % hash->size];
+
+        entry = calloc(1, sizeof(*entry));
+        entry->hash = key_hash;
+        entry->key = malloc(sizeof(*entry->key));
+        *entry->key = *key;
+
+        if (key->type == STORAGE_COLUMN_TYPE_STR) {
+            entry->key->value.str = strdup(key->value.str);
+        }
+
+        entry->next_in_bucket = *bucket;
+        *bucket = entry;
+        ++hash->amount;
+    }
+
+    if (entry->rows.amount == entry->rows.capacity) {
+        entry->rows.capacity = entry->rows.capacity ? 2 * entry->rows.capacity : 1;
+        entry->rows.positions = realloc(entry->rows.positions, sizeof(*entry->rows.positions) * entry->rows.capacity);
+    }
+
+    entry->rows.positions[entry->rows.amount++] = position;
+}
+
+static struct database_join_hash * database_join_hash_build(struct database_table * table, uint16_t column, const struct database_range * range,
+                                                             const struct predicate * filter, struct arena * arena) {
+    struct database_join_hash * hash = malloc(sizeof(*hash));
+
+    hash->amount = 0;
+    hash->size = JOIN_HASH_INITIAL_SIZE;
+    hash->buckets = calloc(JOIN_HASH_INITIAL_SIZE, sizeof(*hash->buckets));
+
+    for (struct database_row * row = database_table_scan(table, range); row; row = database_row_next(row)) {
+        if (filter && !predicate_evaluate_row(filter, row, arena)) {
+            continue;
+        }
+
+        struct arena_mark mark = arena_save(arena);
+        struct database_value * key = database_row_get_value(row, column, arena);
+
+        if (key) {
+            database_join_hash_insert(hash, key, row->position);
+        }
+
+        arena_restore(arena, mark);
+    }
+
+    return hash;
+}
+
+static struct database_join_entry * database_join_hash_find(struct database_join_hash * hash, struct database_value * key) {
+    return database_join_hash_lookup(hash, key, database_value_hash(key));
+}
+
+static void database_join_hash_delete(struct database_join_hash * hash) {
+    if (hash) {
+        for (size_t i = 0; i < hash->size; ++i) {
+            struct database_join_entry * entry = hash->buckets[i];
+
+            while (entry) {
+                struct database_join_entry * next = entry->next_in_bucket;
+
+                database_value_delete(entry->key);
+                free(entry->rows.positions);
+                free(entry);
+                entry = next;
+            }
+        }
+
+        free(hash->buckets);
+    }
+
+    free(hash);
+}
+
+void database_joined_table_delete(struct database_joined_table * table) {
+    if (table) {
+        for (int i = 0; i < table->tables.amount; ++i) {
+            database_join_hash_delete(table->tables.tables[i].hash);
+            database_table_delete(table->tables.tables[i].table);
+        }
+
+        free(table->tables.tables);
+        free(table->tables.order);
+        arena_delete(table->arena);
+    }
+
+    free(table);
+}
+
+static unsigned int database_joined_table_locate(struct database_joined_table * table, uint16_t * index) {
+    unsigned int i = 0;
+
+    while (*index >= table->tables.tables[i].table->columns.amount) {
+        *index -= table->tables.tables[i].table->columns.amount;
+        ++i;
+    }
+
+    return i;
+}
+
+void database_joined_table_plan(struct database_joined_table * table) {
+    unsigned int amount = table->tables.amount;
+
+    if (amount < 3 || amount - 1 > JOIN_PLAN_EXHAUSTIVE_LIMIT) {
+        return;
+    }
+
+    unsigned int parents[amount];
+    double rows[amount];
+    double selectivities[amount];
+
+    database_joined_table_lock(table);
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        struct database_table * source = table->tables.tables[i].table;
+        rows[i] = (double) database_table_estimate_rows(source);
+
+        if (i == 0) {
+            continue;
+        }
+
+        uint16_t column = table->tables.tables[i].s_column_index;
+        parents[i] = database_joined_table_locate(table, &column);
+
+        uint64_t t_distinct = database_table_estimate_distinct(source, table->tables.tables[i].t_column_index);
+        uint64_t s_distinct = database_table_estimate_distinct(table->tables.tables[parents[i]].table, column);
+        uint64_t distinct = t_distinct > s_distinct ? t_distinct : s_distinct;
+
+        selectivities[i] = 1.0 / (double) (distinct > 0 ? distinct : 1);
+    }
+
+    database_joined_table_unlock(table);
+
+    size_t subsets = (size_t) 1 << (amount - 1);
+    double * sizes = malloc(sizeof(*sizes) * subsets);
+    double * costs = malloc(sizeof(*costs) * subsets);
+    unsigned int * lasts = malloc(sizeof(*lasts) * subsets);
+
+    sizes[0] = rows[0];
+    costs[0] = 0;
+
+    for (size_t set = 1; set < subsets; ++set) {
+        costs[set] = -1;
+
+        for (unsigned int i = amount - 1; i > 0; --i) {
+            size_t bit = (size_t) 1 << (i - 1);
+            size_t rest = set & ~bit;
+
+            if (!(set & bit) || costs[rest] < 0 || (parents[i] != 0 && !(rest & ((size_t) 1 << (parents[i] - 1))))) {
+                continue;
+            }
+
+            double size = sizes[rest] * rows[i] * selectivities[i];
+            double cost = costs[rest] + size;
+
+            if (costs[set] < 0 || cost < costs[set] * (1 - 1e-9)) {
+                sizes[set] = size;
+                costs[set] = cost;
+                lasts[set] = i;
+            }
+        }
+    }
+
+    size_t set = subsets - 1;
+    for (unsigned int step = amount - 1; step > 0; --step) {
+        table->tables.order[step] = lasts[set];
+        set &= ~((size_t) 1 << (lasts[set] - 1));
+    }
+
+    table->tables.order[0] = 0;
+
+    free(sizes);
+    free(costs);
+    free(lasts);
+}
+
+static bool database_joined_table_first_of(struct database_joined_table * table, unsigned int index) {
+    for (unsigned int i = 0; i < index; ++i) {
+        if (table->tables.tables[i].table == table->tables.tables[index].table) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void database_joined_table_lock(struct database_joined_table * table) {
+    uintptr_t previous = 0;
+
+    for (unsigned int locked = 0; locked < table->tables.amount; ++locked) {
+        struct database_table * next = NULL;
+
+        for (unsigned int i = 0; i < table->tables.amount; ++i) {
+            uintptr_t address = (uintptr_t) table->tables.tables[i].table;
+
+            if (address > previous && (!next || address < (uintptr_t) next)) {
+                next = table->tables.tables[i].table;
+            }
+        }
+
+        if (!next) {
+            break;
+        }
+
+        database_table_lock(next, false);
+        previous = (uintptr_t) next;
+    }
+}
+
+void database_joined_table_unlock(struct database_joined_table * table) {
+    for (unsigned int i = 0; i < table->tables.amount; ++i) {
+        if (database_joined_table_first_of(table, i)) {
+            database_table_unlock(table->tables.tables[i].table, false);
+        }
+    }
+}
+
 uint16_t database_joined_table_get_columns_amount(struct database_joined_table * table) {
     uint16_t amount = 0;
 
@@ -486,36 +2400,122 @@ uint16_t database_joined_table_get_columns_amount(struct database_joined_table *
     return amount;
 }
 
-static bool database_joined_row(struct database_joined_row * row, uint16_t index) {
-    return database_value_equals(
-            database_joined_row_get_value(row, row->table->tables.tables[index].s_column_index),
-            database_row_get_value(row->rows[index], row->table->tables.tables[index].t_column_index)
-    );
+static bool database_joined_row_matches(struct database_joined_row * row, uint16_t index) {
+    struct arena * arena = row->table->arena;
+    struct arena_mark mark = arena_save(arena);
+
+    struct database_value * s_value = database_joined_row_get_value(row, row->table->tables.tables[index].s_column_index, arena);
+    struct database_value * t_value = database_row_get_value(row->rows[index], row->table->tables.tables[index].t_column_index, arena);
+
+    bool equals = s_value && t_value && database_value_equals(s_value, t_value);
+
+    arena_restore(arena, mark);
+    return equals;
+}
+
+static bool database_joined_row_accepts(struct database_joined_row * row, uint16_t step) {
+    uint16_t index = row->table->tables.order[step];
+    const struct predicate * filter = row->table->tables.tables[index].filter;
+
+    if (step != 0 && !database_joined_row_matches(row, index)) {
+        return false;
+    }
+
+    return !filter || predicate_evaluate_row(filter, row->rows[index], row->table->arena);
 }
 
-static void database_joined_row_roll(struct database_joined_row * row) {
-    for (int i = 1; i < row->table->tables.amount; ++i) {
-        if (!database_joined_row(row, i)) {
-            row->rows[i] = database_row_next(row->rows[i]);
+static void database_joined_row_skip(struct database_joined_row * row, uint16_t step) {
+    uint16_t index = row->table->tables.order[step];
 
-            for (int j = i + 1; j < row->table->tables.amount; ++j) {
-                database_row_delete(row->rows[j]);
-                row->rows[j] = database_table_get_first_row(row->table->tables.tables[j].table);
-            }
+    while (row->rows[index] && !database_joined_row_accepts(row, step)) {
+        row->rows[index] = database_row_next(row->rows[index]);
+    }
+}
 
-            for (int j = i; j > 0; --j) {
-                if (row->rows[j] == NULL) {
-                    row->rows[j] = database_table_get_first_row(row->table->tables.tables[j].table);
-                    row->rows[j - 1] = database_row_next(row->rows[j - 1]);
-                }
-            }
+static void database_joined_row_open(struct database_joined_row * row, uint16_t step) {
+    struct database_joined_table * table = row->table;
+    uint16_t index = table->tables.order[step];
+    struct database_table * source = table->tables.tables[index].table;
+
+    database_row_delete(row->rows[index]);
+
+    if (step != 0 && table->tables.tables[index].method == DATABASE_JOIN_INDEX) {
+        struct arena_mark mark = arena_save(table->arena);
+        struct database_value * key = database_joined_row_get_value(row, table->tables.tables[index].s_column_index, table->arena);
+
+        if (!key) {
+            arena_restore(table->arena, mark);
+            row->rows[index] = NULL;
+            return;
+        }
+
+        struct database_range range = {
+                .index = database_table_find_index(source, table->tables.tables[index].t_column_index),
+                .lower = key,
+                .upper = key,
+                .lower_inclusive = true,
+                .upper_inclusive = true,
+        };
+
+        row->rows[index] = database_table_scan(source, &range);
+        arena_restore(table->arena, mark);
+
+        database_joined_row_skip(row, step);
+        return;
+    }
+
+    if (step == 0 || table->tables.tables[index].method != DATABASE_JOIN_HASH) {
+        row->rows[index] = database_table_scan(source, &table->tables.tables[index].range);
+        database_joined_row_skip(row, step);
+        return;
+    }
+
+    if (!table->tables.tables[index].hash) {
+        table->tables.tables[index].hash = database_join_hash_build(
+                source, table->tables.tables[index].t_column_index, &table->tables.tables[index].range,
+                table->tables.tables[index].filter, table->arena
+        );
+    }
+
+    struct arena_mark mark = arena_save(table->arena);
+    struct database_value * key = database_joined_row_get_value(row, table->tables.tables[index].s_column_index, table->arena);
+    struct database_join_entry * match = database_join_hash_find(table->tables.tables[index].hash, key);
+    arena_restore(table->arena, mark);
+
+    if (!match) {
+        row->rows[index] = NULL;
+        return;
+    }
+
+    uint64_t * positions = malloc(sizeof(*positions) * match->rows.amount);
+    memcpy(positions, match->rows.positions, sizeof(*positions) * match->rows.amount);
+    row->rows[index] = database_table_select(source, positions, match->rows.amount);
+    database_joined_row_skip(row, step);
+}
+
+static void database_joined_row_advance(struct database_joined_row * row, uint16_t step) {
+    uint16_t index = row->table->tables.order[step];
+
+    row->rows[index] = database_row_next(row->rows[index]);
+    database_joined_row_skip(row, step);
+}
 
-            if (row->rows[0] == NULL) {
-                return;
+static bool database_joined_row_settle(struct database_joined_row * row, uint16_t step) {
+    while (true) {
+        if (row->rows[row->table->tables.order[step]] == NULL) {
+            if (step == 0) {
+                return false;
             }
 
-            i = 0;
+            database_joined_row_advance(row, --step);
+            continue;
+        }
+
+        if (step + 1 == row->table->tables.amount) {
+            return true;
         }
+
+        database_joined_row_open(row, ++step);
     }
 }
 
@@ -532,25 +2532,30 @@ void database_joined_row_delete(struct database_joined_row * row) {
 }
 
 struct database_joined_row * database_joined_row_next(struct database_joined_row * row) {
-    uint16_t last_index = row->table->tables.amount - 1;
+    uint16_t last_step = row->table->tables.amount - 1;
 
-    row->rows[last_index] = database_row_next(row->rows[last_index]);
-    for (int i = (int) last_index; i > 0; --i) {
-        if (row->rows[i] == NULL) {
-            row->rows[i] = database_table_get_first_row(row->table->tables.tables[i].table);
-            row->rows[i - 1] = database_row_next(row->rows[i - 1]);
-        }
-    }
-
-    if (row->rows[0] == NULL) {
+    database_joined_row_advance(row, last_step);
+    if (!database_joined_row_settle(row, last_step)) {
         database_joined_row_delete(row);
         return NULL;
     }
 
-    database_joined_row_roll(row);
-    if (row->rows[0] == NULL) {
-        database_joined_row_delete(row);
-        return NULL;
+    return row;
+}
+
+struct database_joined_row * database_joined_row_refresh(struct database_joined_row * row) {
+    for (uint16_t step = 0; step < row->table->tables.amount; ++step) {
+        if (database_joined_row_accepts(row, step)) {
+            continue;
+        }
+
+        database_joined_row_advance(row, step);
+        if (!database_joined_row_settle(row, step)) {
+            database_joined_row_delete(row);
+            return NULL;
+        }
+
+        break;
     }
 
     return row;
@@ -560,22 +2565,10 @@ struct database_joined_row * database_joined_table_get_first_row(struct database
     struct database_joined_row * row = malloc(sizeof(*row));
 
     row->table = table;
-    row->rows = malloc(sizeof(struct database_row *) * table->tables.amount);
-    for (int i = 0; i < table->tables.amount; ++i) {
-        row->rows[i] = NULL;
-    }
-
-    for (int i = 0; i < table->tables.amount; ++i) {
-        row->rows[i] = database_table_get_first_row(table->tables.tables[i].table);
-
-        if (row->rows[i] == NULL) {
-            database_joined_row_delete(row);
-            return NULL;
-        }
-    }
+    row->rows = calloc(table->tables.amount, sizeof(struct database_row *));
 
-    database_joined_row_roll(row);
-    if (row->rows[0] == NULL) {
+    database_joined_row_open(row, 0);
+    if (!database_joined_row_settle(row, 0)) {
         database_joined_row_delete(row);
         return NULL;
     }
@@ -583,10 +2576,10 @@ struct database_joined_row * database_joined_table_get_first_row(struct database
     return row;
 }
 
-struct database_value * database_joined_row_get_value(struct database_joined_row * row, uint16_t index) {
+struct database_value * database_joined_row_get_value(struct database_joined_row * row, uint16_t index, struct arena * arena) {
     for (int i = 0; i < row->table->tables.amount; ++i) {
         if (index < row->table->tables.tables[i].table->columns.amount) {
-            return database_row_get_value(row->rows[i], index);
+            return database_row_get_value(row->rows[i], index, arena);
         }
 
         index -= row->table->tables.tables[i].table->columns.amount;
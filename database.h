@@ -1,8 +1,25 @@
 #pragma once
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "arena.h"
+#include "page_cache.h"
+
 static const char * const JOINED_TABLE_NAME = "joined table";
 
+struct predicate;
+
+#define DATABASE_SIZE_CLASSES_AMOUNT 17
+#define DATABASE_STATISTICS_BUCKETS 1024
+
+enum database_join_method {
+    DATABASE_JOIN_NESTED_LOOP = 0,
+    DATABASE_JOIN_HASH = 1,
+    DATABASE_JOIN_INDEX = 2,
+};
+
 enum database_column_type {
     STORAGE_COLUMN_TYPE_INT = 0,
     STORAGE_COLUMN_TYPE_UINT = 1,
@@ -10,9 +27,34 @@ enum database_column_type {
     STORAGE_COLUMN_TYPE_STR = 3,
 };
 
+struct database_options {
+    size_t cache_size;
+    int wal_fd;
+};
+
 struct database {
     int fd;
+    uint32_t version;
     uint64_t first_table;
+    uint64_t first_index;
+    uint64_t free_lists[DATABASE_SIZE_CLASSES_AMOUNT];
+
+    struct database_options options;
+    struct page_cache * cache;
+    struct wal * wal;
+
+    struct {
+        unsigned int amount;
+        unsigned int size;
+        struct database_table ** buckets;
+    } catalog;
+
+    struct {
+        pthread_rwlock_t schema;
+        pthread_rwlock_t commit;
+        pthread_mutex_t allocator;
+        pthread_mutex_t catalog;
+    } locks;
 };
 
 struct database_column {
@@ -20,8 +62,26 @@ struct database_column {
     enum database_column_type type;
 };
 
+struct database_index {
+    struct database_table * table;
+
+    uint64_t position;
+    uint64_t root;
+
+    uint16_t column;
+    char * name;
+
+    struct database_index * next;
+};
+
+struct database_column_statistics {
+    uint64_t nulls;
+    uint32_t buckets[DATABASE_STATISTICS_BUCKETS];
+};
+
 struct database_table {
     struct database * storage;
+    unsigned int refs;
 
     uint64_t position;
     uint64_t next;
@@ -33,6 +93,20 @@ struct database_table {
         uint16_t amount;
         struct database_column * columns;
     } columns;
+
+    struct database_index * indexes;
+    struct database_table * next_in_bucket;
+
+    pthread_rwlock_t lock;
+    uint64_t generation;
+    bool cataloged;
+
+    struct {
+        pthread_mutex_t lock;
+        bool ready;
+        uint64_t rows;
+        struct database_column_statistics * columns;
+    } statistics;
 };
 
 struct database_row {
@@ -40,6 +114,12 @@ struct database_row {
 
     uint64_t position;
     uint64_t next;
+
+    struct {
+        size_t amount;
+        size_t current;
+        uint64_t * positions;
+    } selection;
 };
 
 struct database_value {
@@ -53,6 +133,34 @@ struct database_value {
     } value;
 };
 
+struct database_range {
+    struct database_index * index;
+
+    struct database_value * lower;
+    struct database_value * upper;
+    bool lower_inclusive;
+    bool upper_inclusive;
+};
+
+struct database_join_entry {
+    uint64_t hash;
+    struct database_value * key;
+
+    struct {
+        size_t amount;
+        size_t capacity;
+        uint64_t * positions;
+    } rows;
+
+    struct database_join_entry * next_in_bucket;
+};
+
+struct database_join_hash {
+    size_t amount;
+    size_t size;
+    struct database_join_entry ** buckets;
+};
+
 struct database_joined_table {
     struct {
         unsigned int amount;
@@ -60,8 +168,16 @@ struct database_joined_table {
             struct database_table * table;
             uint16_t t_column_index;
             uint16_t s_column_index;
+            struct database_range range;
+
+            enum database_join_method method;
+            struct database_join_hash * hash;
+            const struct predicate * filter;
         } * tables;
+        unsigned int * order;
     } tables;
+
+    struct arena * arena;
 };
 
 struct database_joined_row {
@@ -69,34 +185,63 @@ struct database_joined_row {
     struct database_row ** rows;
 };
 
-struct database * database_init(int fd);
-struct database * database_open(int fd);
+struct database * database_init(int fd, const struct database_options * options);
+struct database * database_open(int fd, const struct database_options * options);
+struct database * database_open_mapped(int fd, const struct database_options * options);
 void delete_database(struct database * storage);
 
+int database_flush(struct database * storage);
+int database_sync(struct database * storage);
+int database_compact(struct database * storage, const char * path);
+
+void database_lock(struct database * storage, bool exclusive);
+void database_unlock(struct database * storage);
+
+int database_get_error(void);
+void database_clear_error(void);
+
 struct database_table * database_find_table(struct database * storage, const char * name);
 
 void database_table_delete(struct database_table * table);
 
+void database_table_lock(struct database_table * table, bool exclusive);
+void database_table_unlock(struct database_table * table, bool exclusive);
+
 void database_table_add(struct database_table * table);
 void database_table_remove(struct database_table * table);
 struct database_row * database_table_get_first_row(struct database_table * table);
+struct database_row * database_table_scan(struct database_table * table, const struct database_range * range);
 struct database_row * database_table_add_row(struct database_table * table);
+struct database_row * database_table_insert_row(struct database_table * table, struct database_value ** values);
+int database_table_insert_rows(struct database_table * table, size_t amount, struct database_value *** values);
+
+uint64_t database_table_estimate_rows(struct database_table * table);
+uint64_t database_table_estimate_distinct(struct database_table * table, uint16_t column);
+
+int database_index_add(struct database_table * table, const char * name, uint16_t column);
+struct database_index * database_table_find_index(struct database_table * table, uint16_t column);
 
 void database_row_delete(struct database_row * row);
 
 struct database_row * database_row_next(struct database_row * row);
 void database_row_remove(struct database_row * row);
-struct database_value * database_row_get_value(struct database_row * row, uint16_t index);
+struct database_value * database_row_get_value(struct database_row * row, uint16_t index, struct arena * arena);
 void database_row_set_value(struct database_row * row, uint16_t index, struct database_value * value);
 
 void database_value_destroy(struct database_value value);
 void database_value_delete(struct database_value * value);
+bool database_value_equals(const struct database_value * a, const struct database_value * b);
+uint64_t database_value_hash(const struct database_value * value);
 
 const char * database_column_type_to_string(enum database_column_type type);
 
 struct database_joined_table * database_joined_table_new(unsigned int amount);
 struct database_joined_table * database_joined_table_wrap(struct database_table * table);
 void database_joined_table_delete(struct database_joined_table * table);
+void database_joined_table_plan(struct database_joined_table * table);
+
+void database_joined_table_lock(struct database_joined_table * table);
+void database_joined_table_unlock(struct database_joined_table * table);
 
 uint16_t database_joined_table_get_columns_amount(struct database_joined_table * table);
 struct database_column database_joined_table_get_column(struct database_joined_table * table, uint16_t index);
@@ -105,4 +250,5 @@ struct database_joined_row * database_joined_table_get_first_row(struct database
 void database_joined_row_delete(struct database_joined_row * row);
 
 struct database_joined_row * database_joined_row_next(struct database_joined_row * row);
-struct database_value * database_joined_row_get_value(struct database_joined_row * row, uint16_t index);
+struct database_joined_row * database_joined_row_refresh(struct database_joined_row * row);
+struct database_value * database_joined_row_get_value(struct database_joined_row * row, uint16_t index, struct arena * arena);
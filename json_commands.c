@@ -1,7 +1,10 @@
 #include "json_commands.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
+#include <inttypes.h>
 
 enum json_api_action json_api_get_action(struct json_object * object) {
     json_object_object_foreach(object, key, val) {
@@ -13,25 +16,25 @@ enum json_api_action json_api_get_action(struct json_object * object) {
     return -1;
 }
 
-struct json_api_create_table_request json_api_to_create_table_request(struct json_object * object) {
+struct json_api_create_table_request json_api_to_create_table_request(struct json_object * object, struct arena * arena) {
     struct json_api_create_table_request request;
 
     json_object_object_foreach(object, key, val) {
         if (strcmp("table", key) == 0) {
-            request.table_name = strdup(json_object_get_string(val));
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
             continue;
         }
 
         if (strcmp("columns", key) == 0) {
             request.columns.amount = json_object_array_length(val);
-            request.columns.columns = malloc(sizeof(*request.columns.columns) * request.columns.amount);
+            request.columns.columns = arena_alloc(arena, sizeof(*request.columns.columns) * request.columns.amount);
 
             for (int i = 0; i < request.columns.amount; ++i) {
                 struct json_object * elem = json_object_array_get_idx(val, i);
 
                 json_object_object_foreach(elem, elem_key, elem_val) {
                     if (strcmp("name", elem_key) == 0) {
-                        request.columns.columns[i].name = strdup(json_object_get_string(elem_val));
+                        request.columns.columns[i].name = arena_strdup(arena, json_object_get_string(elem_val));
                         continue;
                     }
 
@@ -49,13 +52,13 @@ struct json_api_create_table_request json_api_to_create_table_request(struct jso
     return request;
 }
 
-struct json_api_drop_table_request json_api_to_drop_table_request(struct json_object * object) {
+struct json_api_drop_table_request json_api_to_drop_table_request(struct json_object * object, struct arena * arena) {
     struct json_api_drop_table_request request;
     request.table_name = NULL;
 
     json_object_object_foreach(object, key, val) {
         if (strcmp("table", key) == 0) {
-            request.table_name = strdup(json_object_get_string(val));
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
             break;
         }
     }
@@ -63,7 +66,7 @@ struct json_api_drop_table_request json_api_to_drop_table_request(struct json_ob
     return request;
 }
 
-static struct database_value * json_to_storage_value(struct json_object * object) {
+static struct database_value * json_to_storage_value(struct json_object * object, struct arena * arena) {
     struct database_value * value;
 
     switch (json_object_get_type(object)) {
@@ -76,13 +79,13 @@ static struct database_value * json_to_storage_value(struct json_object * object
             return NULL;
 
         case json_type_double:
-            value = malloc(sizeof(*value));
+            value = arena_alloc(arena, sizeof(*value));
             value->type = STORAGE_COLUMN_TYPE_NUM;
             value->value.num = json_object_get_double(object);
             break;
 
         case json_type_int:
-            value = malloc(sizeof(*value));
+            value = arena_alloc(arena, sizeof(*value));
             value->value._int = json_object_get_int64(object);
 
             if (value->value._int < 0) {
@@ -95,44 +98,63 @@ static struct database_value * json_to_storage_value(struct json_object * object
             break;
 
         case json_type_string:
-            value = malloc(sizeof(*value));
+            value = arena_alloc(arena, sizeof(*value));
             value->type = STORAGE_COLUMN_TYPE_STR;
-            value->value.str = strdup(json_object_get_string(object));
+            value->value.str = arena_strdup(arena, json_object_get_string(object));
             break;
     }
 
     return value;
 }
 
-struct json_api_insert_request json_api_to_insert_request(struct json_object * object) {
+static void json_api_to_insert_row(struct json_api_insert_row * row, struct json_object * object, struct arena * arena) {
+    row->amount = json_object_array_length(object);
+    row->values = arena_alloc(arena, sizeof(*row->values) * row->amount);
+
+    for (int i = 0; i < row->amount; ++i) {
+        row->values[i] = json_to_storage_value(json_object_array_get_idx(object, i), arena);
+    }
+}
+
+struct json_api_insert_request json_api_to_insert_request(struct json_object * object, struct arena * arena) {
     struct json_api_insert_request request;
 
     request.columns.amount = 0;
     request.columns.columns = NULL;
+    request.rows.amount = 0;
+    request.rows.rows = NULL;
 
     json_object_object_foreach(object, key, val) {
         if (strcmp("table", key) == 0) {
-            request.table_name = strdup(json_object_get_string(val));
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
             continue;
         }
 
         if (strcmp("columns", key) == 0) {
             request.columns.amount = json_object_array_length(val);
-            request.columns.columns = malloc(sizeof(*request.columns.columns) * request.columns.amount);
+            request.columns.columns = arena_alloc(arena, sizeof(*request.columns.columns) * request.columns.amount);
 
             for (int i = 0; i < request.columns.amount; ++i) {
-                request.columns.columns[i] = strdup(json_object_get_string(json_object_array_get_idx(val, i)));
+                request.columns.columns[i] = arena_strdup(arena, json_object_get_string(json_object_array_get_idx(val, i)));
             }
 
             continue;
         }
 
         if (strcmp("values", key) == 0) {
-            request.values.amount = json_object_array_length(val);
-            request.values.values = malloc(sizeof(struct database_value *) * request.values.amount);
+            struct json_object * first = json_object_array_get_idx(val, 0);
 
-            for (int i = 0; i < request.values.amount; ++i) {
-                request.values.values[i] = json_to_storage_value(json_object_array_get_idx(val, i));
+            if (json_object_is_type(first, json_type_array)) {
+                request.rows.amount = json_object_array_length(val);
+                request.rows.rows = arena_alloc(arena, sizeof(*request.rows.rows) * request.rows.amount);
+
+                for (int i = 0; i < request.rows.amount; ++i) {
+                    json_api_to_insert_row(&request.rows.rows[i], json_object_array_get_idx(val, i), arena);
+                }
+            } else {
+                request.rows.amount = 1;
+                request.rows.rows = arena_alloc(arena, sizeof(*request.rows.rows));
+                json_api_to_insert_row(&request.rows.rows[0], val, arena);
             }
 
             continue;
@@ -142,8 +164,8 @@ struct json_api_insert_request json_api_to_insert_request(struct json_object * o
     return request;
 }
 
-static struct json_api_where * json_api_to_where(struct json_object * object) {
-    struct json_api_where * where = malloc(sizeof(*where));
+static struct json_api_where * json_api_to_where(struct json_object * object, struct arena * arena) {
+    struct json_api_where * where = arena_alloc(arena, sizeof(*where));
 
     {
         json_object_object_foreach(object, key, val) {
@@ -164,12 +186,12 @@ static struct json_api_where * json_api_to_where(struct json_object * object) {
         {
             json_object_object_foreach(object, key, val) {
                 if (strcmp("column", key) == 0) {
-                    where->column = strdup(json_object_get_string(val));
+                    where->column = arena_strdup(arena, json_object_get_string(val));
                     continue;
                 }
 
                 if (strcmp("value", key) == 0) {
-                    where->value = json_to_storage_value(val);
+                    where->value = json_to_storage_value(val, arena);
                     continue;
                 }
             }
@@ -182,12 +204,12 @@ static struct json_api_where * json_api_to_where(struct json_object * object) {
         {
             json_object_object_foreach(object, key, val) {
                 if (strcmp("left", key) == 0) {
-                    where->left = json_api_to_where(val);
+                    where->left = json_api_to_where(val, arena);
                     continue;
                 }
 
                 if (strcmp("right", key) == 0) {
-                    where->right = json_api_to_where(val);
+                    where->right = json_api_to_where(val, arena);
                     continue;
                 }
             }
@@ -199,18 +221,18 @@ static struct json_api_where * json_api_to_where(struct json_object * object) {
     return where;
 }
 
-struct json_api_delete_request json_api_to_delete_request(struct json_object * object) {
+struct json_api_delete_request json_api_to_delete_request(struct json_object * object, struct arena * arena) {
     struct json_api_delete_request request;
     request.where = NULL;
 
     json_object_object_foreach(object, key, val) {
         if (strcmp("table", key) == 0) {
-            request.table_name = strdup(json_object_get_string(val));
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
             continue;
         }
 
         if (strcmp("where", key) == 0) {
-            request.where = json_api_to_where(val);
+            request.where = json_api_to_where(val, arena);
             continue;
         }
     }
@@ -218,35 +240,99 @@ struct json_api_delete_request json_api_to_delete_request(struct json_object * o
     return request;
 }
 
-struct json_api_select_request json_api_to_select_request(struct json_object * object) {
+struct json_api_select_request json_api_to_select_request(struct json_object * object, struct arena * arena) {
     struct json_api_select_request request;
     request.columns.amount = 0;
     request.columns.columns = NULL;
+    request.columns.aggregates = NULL;
     request.joins.amount = 0;
     request.joins.joins = NULL;
+    request.group.amount = 0;
+    request.group.columns = NULL;
+    request.order.amount = 0;
+    request.order.columns = NULL;
     request.where = NULL;
     request.offset = 0;
     request.limit = 10;
 
     json_object_object_foreach(object, key, val) {
         if (strcmp("table", key) == 0) {
-            request.table_name = strdup(json_object_get_string(val));
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
             continue;
         }
 
         if (strcmp("columns", key) == 0) {
             request.columns.amount = json_object_array_length(val);
-            request.columns.columns = malloc(sizeof(*request.columns.columns) * request.columns.amount);
+            request.columns.columns = arena_alloc(arena, sizeof(*request.columns.columns) * request.columns.amount);
+            request.columns.aggregates = arena_alloc(arena, sizeof(*request.columns.aggregates) * request.columns.amount);
 
             for (int i = 0; i < request.columns.amount; ++i) {
-                request.columns.columns[i] = strdup(json_object_get_string(json_object_array_get_idx(val, i)));
+                struct json_object * elem = json_object_array_get_idx(val, i);
+
+                request.columns.columns[i] = NULL;
+                request.columns.aggregates[i] = JSON_API_AGGREGATE_NONE;
+
+                if (!json_object_is_type(elem, json_type_object)) {
+                    request.columns.columns[i] = arena_strdup(arena, json_object_get_string(elem));
+                    continue;
+                }
+
+                json_object_object_foreach(elem, elem_key, elem_val) {
+                    if (strcmp("function", elem_key) == 0) {
+                        request.columns.aggregates[i] = (enum json_api_aggregate) json_object_get_int(elem_val);
+                    }
+
+                    if (strcmp("column", elem_key) == 0) {
+                        request.columns.columns[i] = arena_strdup(arena, json_object_get_string(elem_val));
+                    }
+                }
             }
 
             continue;
         }
 
         if (strcmp("where", key) == 0) {
-            request.where = json_api_to_where(val);
+            request.where = json_api_to_where(val, arena);
+            continue;
+        }
+
+        if (strcmp("group", key) == 0) {
+            request.group.amount = json_object_array_length(val);
+            request.group.columns = arena_alloc(arena, sizeof(*request.group.columns) * request.group.amount);
+
+            for (int i = 0; i < request.group.amount; ++i) {
+                request.group.columns[i] = arena_strdup(arena, json_object_get_string(json_object_array_get_idx(val, i)));
+            }
+
+            continue;
+        }
+
+        if (strcmp("order", key) == 0) {
+            request.order.amount = json_object_array_length(val);
+            request.order.columns = arena_alloc(arena, sizeof(*request.order.columns) * request.order.amount);
+
+            for (int i = 0; i < request.order.amount; ++i) {
+                struct json_object * elem = json_object_array_get_idx(val, i);
+
+                request.order.columns[i].column = NULL;
+                request.order.columns[i].function = JSON_API_AGGREGATE_NONE;
+                request.order.columns[i].descending = false;
+
+                json_object_object_foreach(elem, elem_key, elem_val) {
+                    if (strcmp("column", elem_key) == 0) {
+                        request.order.columns[i].column = arena_strdup(arena, json_object_get_string(elem_val));
+                    }
+
+                    if (strcmp("function", elem_key) == 0) {
+                        request.order.columns[i].function = (enum json_api_aggregate) json_object_get_int(elem_val);
+                    }
+
+                    if (strcmp("descending", elem_key) == 0) {
+                        request.order.columns[i].descending = json_object_get_boolean(elem_val);
+                    }
+                }
+            }
+
             continue;
         }
 
@@ -262,22 +348,22 @@ struct json_api_select_request json_api_to_select_request(struct json_object * o
 
         if (strcmp("joins", key) == 0) {
             request.joins.amount = json_object_array_length(val);
-            request.joins.joins = malloc(sizeof(*request.joins.joins) * request.joins.amount);
+            request.joins.joins = arena_alloc(arena, sizeof(*request.joins.joins) * request.joins.amount);
 
             for (int i = 0; i < request.joins.amount; ++i) {
                 struct json_object * elem = json_object_array_get_idx(val, i);
 
                 json_object_object_foreach(elem, elem_key, elem_val) {
                     if (strcmp("table", elem_key) == 0) {
-                        request.joins.joins[i].table = strdup(json_object_get_string(elem_val));
+                        request.joins.joins[i].table = arena_strdup(arena, json_object_get_string(elem_val));
                     }
 
                     if (strcmp("t_column", elem_key) == 0) {
-                        request.joins.joins[i].t_column = strdup(json_object_get_string(elem_val));
+                        request.joins.joins[i].t_column = arena_strdup(arena, json_object_get_string(elem_val));
                     }
 
                     if (strcmp("s_column", elem_key) == 0) {
-                        request.joins.joins[i].s_column = strdup(json_object_get_string(elem_val));
+                        request.joins.joins[i].s_column = arena_strdup(arena, json_object_get_string(elem_val));
                     }
                 }
             }
@@ -289,22 +375,22 @@ struct json_api_select_request json_api_to_select_request(struct json_object * o
     return request;
 }
 
-struct json_api_update_request json_api_to_update_request(struct json_object * object) {
+struct json_api_update_request json_api_to_update_request(struct json_object * object, struct arena * arena) {
     struct json_api_update_request request;
     request.where = NULL;
 
     json_object_object_foreach(object, key, val) {
         if (strcmp("table", key) == 0) {
-            request.table_name = strdup(json_object_get_string(val));
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
             continue;
         }
 
         if (strcmp("columns", key) == 0) {
             request.columns.amount = json_object_array_length(val);
-            request.columns.columns = malloc(sizeof(*request.columns.columns) * request.columns.amount);
+            request.columns.columns = arena_alloc(arena, sizeof(*request.columns.columns) * request.columns.amount);
 
             for (int i = 0; i < request.columns.amount; ++i) {
-                request.columns.columns[i] = strdup(json_object_get_string(json_object_array_get_idx(val, i)));
+                request.columns.columns[i] = arena_strdup(arena, json_object_get_string(json_object_array_get_idx(val, i)));
             }
 
             continue;
@@ -312,17 +398,123 @@ struct json_api_update_request json_api_to_update_request(struct json_object * o
 
         if (strcmp("values", key) == 0) {
             request.values.amount = json_object_array_length(val);
-            request.values.values = malloc(sizeof(struct database_value *) * request.values.amount);
+            request.values.values = arena_alloc(arena, sizeof(struct database_value *) * request.values.amount);
 
             for (int i = 0; i < request.values.amount; ++i) {
-                request.values.values[i] = json_to_storage_value(json_object_array_get_idx(val, i));
+                request.values.values[i] = json_to_storage_value(json_object_array_get_idx(val, i), arena);
             }
 
             continue;
         }
 
         if (strcmp("where", key) == 0) {
-            request.where = json_api_to_where(val);
+            request.where = json_api_to_where(val, arena);
+            continue;
+        }
+    }
+
+    return request;
+}
+
+struct json_api_create_index_request json_api_to_create_index_request(struct json_object * object, struct arena * arena) {
+    struct json_api_create_index_request request;
+    request.index_name = NULL;
+    request.table_name = NULL;
+    request.column = NULL;
+
+    json_object_object_foreach(object, key, val) {
+        if (strcmp("index", key) == 0) {
+            request.index_name = arena_strdup(arena, json_object_get_string(val));
+            continue;
+        }
+
+        if (strcmp("table", key) == 0) {
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
+            continue;
+        }
+
+        if (strcmp("column", key) == 0) {
+            request.column = arena_strdup(arena, json_object_get_string(val));
+            continue;
+        }
+    }
+
+    return request;
+}
+
+struct json_api_declare_cursor_request json_api_to_declare_cursor_request(struct json_object * object, struct arena * arena) {
+    struct json_api_declare_cursor_request request;
+    request.cursor_name = NULL;
+    request.select = json_api_to_select_request(object, arena);
+
+    struct json_object * cursor;
+    if (json_object_object_get_ex(object, "cursor", &cursor)) {
+        request.cursor_name = arena_strdup(arena, json_object_get_string(cursor));
+    }
+
+    return request;
+}
+
+struct json_api_fetch_request json_api_to_fetch_request(struct json_object * object, struct arena * arena) {
+    struct json_api_fetch_request request;
+    request.cursor_name = NULL;
+    request.amount = 10;
+
+    json_object_object_foreach(object, key, val) {
+        if (strcmp("cursor", key) == 0) {
+            request.cursor_name = arena_strdup(arena, json_object_get_string(val));
+            continue;
+        }
+
+        if (strcmp("amount", key) == 0) {
+            request.amount = json_object_get_int(val);
+            continue;
+        }
+    }
+
+    return request;
+}
+
+struct json_api_close_cursor_request json_api_to_close_cursor_request(struct json_object * object, struct arena * arena) {
+    struct json_api_close_cursor_request request;
+    request.cursor_name = NULL;
+
+    json_object_object_foreach(object, key, val) {
+        if (strcmp("cursor", key) == 0) {
+            request.cursor_name = arena_strdup(arena, json_object_get_string(val));
+            continue;
+        }
+    }
+
+    return request;
+}
+
+struct json_api_copy_request json_api_to_copy_request(struct json_object * object, struct arena * arena) {
+    struct json_api_copy_request request;
+    request.table_name = NULL;
+    request.columns.amount = 0;
+    request.columns.columns = NULL;
+    request.path = NULL;
+
+    json_object_object_foreach(object, key, val) {
+        if (strcmp("table", key) == 0) {
+            request.table_name = arena_strdup(arena, json_object_get_string(val));
+            continue;
+        }
+
+        if (strcmp("columns", key) == 0) {
+            request.columns.amount = json_object_array_length(val);
+            request.columns.columns = arena_alloc(arena, sizeof(*request.columns.columns) * request.columns.amount);
+
+            for (int i = 0; i < request.columns.amount; ++i) {
+                request.columns.columns[i] = arena_strdup(arena, json_object_get_string(json_object_array_get_idx(val, i)));
+            }
+
+            continue;
+        }
+
+        if (strcmp("path", key) == 0) {
+            request.path = arena_strdup(arena, json_object_get_string(val));
             continue;
         }
     }
@@ -363,3 +555,180 @@ struct json_object * json_api_from_value(struct database_value * value) {
             return json_object_new_string(value->value.str);
     }
 }
+
+const char * json_api_aggregate_to_string(enum json_api_aggregate aggregate) {
+    switch (aggregate) {
+        case JSON_API_AGGREGATE_COUNT:
+            return "count";
+
+        case JSON_API_AGGREGATE_SUM:
+            return "sum";
+
+        case JSON_API_AGGREGATE_MIN:
+            return "min";
+
+        case JSON_API_AGGREGATE_MAX:
+            return "max";
+
+        case JSON_API_AGGREGATE_AVG:
+            return "avg";
+
+        default:
+            return NULL;
+    }
+}
+
+static void json_api_put_literal(struct buffer * buffer, const char * literal) {
+    buffer_append(buffer, literal, strlen(literal));
+}
+
+static void json_api_put_string(struct buffer * buffer, const char * str) {
+    static const char hex[] = "0123456789abcdef";
+
+    const char * begin = str;
+    *buffer_reserve(buffer, 1) = '"';
+
+    for (; *str; ++str) {
+        unsigned char c = (unsigned char) *str;
+        char escaped[6] = {'\\'};
+        size_t length = 2;
+
+        switch (c) {
+            case '\b':
+                escaped[1] = 'b';
+                break;
+
+            case '\f':
+                escaped[1] = 'f';
+                break;
+
+            case '\n':
+                escaped[1] = 'n';
+                break;
+
+            case '\r':
+                escaped[1] = 'r';
+                break;
+
+            case '\t':
+                escaped[1] = 't';
+                break;
+
+            case '"':
+            case '\\':
+            case '/':
+                escaped[1] = (char) c;
+                break;
+
+            default:
+                if (c >= 0x20) {
+                    continue;
+                }
+
+                escaped[1] = 'u';
+                escaped[2] = '0';
+                escaped[3] = '0';
+                escaped[4] = hex[c >> 4];
+                escaped[5] = hex[c & 0xf];
+                length = 6;
+                break;
+        }
+
+        buffer_append(buffer, begin, str - begin);
+        buffer_append(buffer, escaped, length);
+        begin = str + 1;
+    }
+
+    buffer_append(buffer, begin, str - begin);
+    *buffer_reserve(buffer, 1) = '"';
+}
+
+static void json_api_put_double(struct buffer * buffer, double value) {
+    if (isnan(value)) {
+        json_api_put_literal(buffer, "NaN");
+        return;
+    }
+
+    if (isinf(value)) {
+        json_api_put_literal(buffer, value > 0 ? "Infinity" : "-Infinity");
+        return;
+    }
+
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%.17g", value);
+
+    buffer_append(buffer, text, length);
+    if (!strpbrk(text, ".e")) {
+        json_api_put_literal(buffer, ".0");
+    }
+}
+
+static void json_api_put_value(struct buffer * buffer, struct database_value * value) {
+    char text[24];
+
+    if (value == NULL) {
+        json_api_put_literal(buffer, "null");
+        return;
+    }
+
+    switch (value->type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            buffer_append(buffer, text, snprintf(text, sizeof(text), "%" PRId64, value->value._int));
+            break;
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            buffer_append(buffer, text, snprintf(text, sizeof(text), "%" PRIu64, value->value.uint));
+            break;
+
+        case STORAGE_COLUMN_TYPE_NUM:
+            json_api_put_double(buffer, value->value.num);
+            break;
+
+        case STORAGE_COLUMN_TYPE_STR:
+            json_api_put_string(buffer, value->value.str);
+            break;
+    }
+}
+
+void json_api_put_columns(struct buffer * buffer, unsigned int amount, const struct database_column * columns) {
+    json_api_put_literal(buffer, "{ \"success\": { \"columns\": [ ");
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        if (i > 0) {
+            json_api_put_literal(buffer, ", ");
+        }
+
+        json_api_put_string(buffer, columns[i].name);
+    }
+
+    json_api_put_literal(buffer, " ], \"values\": [ ");
+}
+
+void json_api_put_row(struct buffer * buffer, unsigned int amount, struct database_value ** values, bool first) {
+    json_api_put_literal(buffer, first ? "[ " : ", [ ");
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        if (i > 0) {
+            json_api_put_literal(buffer, ", ");
+        }
+
+        json_api_put_value(buffer, values[i]);
+    }
+
+    json_api_put_literal(buffer, " ]");
+}
+
+void json_api_put_rows_end(struct buffer * buffer) {
+    json_api_put_literal(buffer, " ] } }");
+}
+
+void json_api_put_frame_header(uint8_t * header, uint32_t length) {
+    header[0] = (uint8_t) (length >> 24);
+    header[1] = (uint8_t) (length >> 16);
+    header[2] = (uint8_t) (length >> 8);
+    header[3] = (uint8_t) length;
+}
+
+uint32_t json_api_get_frame_length(const uint8_t * header) {
+    return ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16) | ((uint32_t) header[2] << 8) | header[3];
+}
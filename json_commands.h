@@ -1,8 +1,14 @@
 #pragma once
 
 #include <json-c/json.h>
+#include "arena.h"
+#include "buffer.h"
 #include "database.h"
 
+#define JSON_API_FRAME_HEADER_SIZE 4
+#define JSON_API_FRAME_MAX_SIZE (256 * 1024 * 1024)
+#define JSON_API_FRAME_MORE (UINT32_C(1) << 31)
+
 enum json_api_action {
     JSON_API_TYPE_CREATE_TABLE = 0,
     JSON_API_TYPE_DROP_TABLE = 1,
@@ -10,6 +16,12 @@ enum json_api_action {
     JSON_API_TYPE_DELETE = 3,
     JSON_API_TYPE_SELECT = 4,
     JSON_API_TYPE_UPDATE = 5,
+    JSON_API_TYPE_VACUUM = 6,
+    JSON_API_TYPE_CREATE_INDEX = 7,
+    JSON_API_TYPE_DECLARE_CURSOR = 8,
+    JSON_API_TYPE_FETCH = 9,
+    JSON_API_TYPE_CLOSE_CURSOR = 10,
+    JSON_API_TYPE_COPY = 11,
 };
 
 struct json_api_create_table_request {
@@ -27,6 +39,11 @@ struct json_api_drop_table_request {
     char * table_name;
 };
 
+struct json_api_insert_row {
+    unsigned int amount;
+    struct database_value ** values;
+};
+
 struct json_api_insert_request {
     char * table_name;
     struct {
@@ -35,8 +52,8 @@ struct json_api_insert_request {
     } columns;
     struct {
         unsigned int amount;
-        struct database_value ** values;
-    } values;
+        struct json_api_insert_row * rows;
+    } rows;
 };
 
 enum json_api_operator {
@@ -71,11 +88,21 @@ struct json_api_delete_request {
     struct json_api_where * where;
 };
 
+enum json_api_aggregate {
+    JSON_API_AGGREGATE_NONE = 0,
+    JSON_API_AGGREGATE_COUNT = 1,
+    JSON_API_AGGREGATE_SUM = 2,
+    JSON_API_AGGREGATE_MIN = 3,
+    JSON_API_AGGREGATE_MAX = 4,
+    JSON_API_AGGREGATE_AVG = 5,
+};
+
 struct json_api_select_request {
     char * table_name;
     struct {
         unsigned int amount;
         char ** columns;
+        enum json_api_aggregate * aggregates;
     } columns;
     struct json_api_where * where;
     unsigned int offset;
@@ -88,6 +115,18 @@ struct json_api_select_request {
             char * s_column;
         } * joins;
     } joins;
+    struct {
+        unsigned int amount;
+        char ** columns;
+    } group;
+    struct {
+        unsigned int amount;
+        struct {
+            char * column;
+            enum json_api_aggregate function;
+            bool descending;
+        } * columns;
+    } order;
 };
 
 struct json_api_update_request {
@@ -103,16 +142,59 @@ struct json_api_update_request {
     struct json_api_where * where;
 };
 
+struct json_api_create_index_request {
+    char * index_name;
+    char * table_name;
+    char * column;
+};
+
+struct json_api_declare_cursor_request {
+    char * cursor_name;
+    struct json_api_select_request select;
+};
+
+struct json_api_fetch_request {
+    char * cursor_name;
+    unsigned int amount;
+};
+
+struct json_api_close_cursor_request {
+    char * cursor_name;
+};
+
+struct json_api_copy_request {
+    char * table_name;
+    struct {
+        unsigned int amount;
+        char ** columns;
+    } columns;
+    char * path;
+};
+
 enum json_api_action json_api_get_action(struct json_object * object);
 
-struct json_api_create_table_request json_api_to_create_table_request(struct json_object * object);
-struct json_api_drop_table_request json_api_to_drop_table_request(struct json_object * object);
-struct json_api_insert_request json_api_to_insert_request(struct json_object * object);
-struct json_api_delete_request json_api_to_delete_request(struct json_object * object);
-struct json_api_select_request json_api_to_select_request(struct json_object * object);
-struct json_api_update_request json_api_to_update_request(struct json_object * object);
+struct json_api_create_table_request json_api_to_create_table_request(struct json_object * object, struct arena * arena);
+struct json_api_drop_table_request json_api_to_drop_table_request(struct json_object * object, struct arena * arena);
+struct json_api_insert_request json_api_to_insert_request(struct json_object * object, struct arena * arena);
+struct json_api_delete_request json_api_to_delete_request(struct json_object * object, struct arena * arena);
+struct json_api_select_request json_api_to_select_request(struct json_object * object, struct arena * arena);
+struct json_api_update_request json_api_to_update_request(struct json_object * object, struct arena * arena);
+struct json_api_create_index_request json_api_to_create_index_request(struct json_object * object, struct arena * arena);
+struct json_api_declare_cursor_request json_api_to_declare_cursor_request(struct json_object * object, struct arena * arena);
+struct json_api_fetch_request json_api_to_fetch_request(struct json_object * object, struct arena * arena);
+struct json_api_close_cursor_request json_api_to_close_cursor_request(struct json_object * object, struct arena * arena);
+struct json_api_copy_request json_api_to_copy_request(struct json_object * object, struct arena * arena);
 
 struct json_object * json_api_make_success(struct json_object * answer);
 struct json_object * json_api_make_error(const char * msg);
 
 struct json_object * json_api_from_value(struct database_value * value);
+
+const char * json_api_aggregate_to_string(enum json_api_aggregate aggregate);
+
+void json_api_put_columns(struct buffer * buffer, unsigned int amount, const struct database_column * columns);
+void json_api_put_row(struct buffer * buffer, unsigned int amount, struct database_value ** values, bool first);
+void json_api_put_rows_end(struct buffer * buffer);
+
+void json_api_put_frame_header(uint8_t * header, uint32_t length);
+uint32_t json_api_get_frame_length(const uint8_t * header);
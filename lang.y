@@ -2,18 +2,22 @@
 
 %{
 #include <string.h>
+#include <strings.h>
 
-#include "../json_api.h"
+#include "../json_commands.h"
 
 int yylex(void);
 void yyerror(struct json_object ** result, char ** error, const char * str);
+
+static struct json_object * aggregate_column(struct json_object * function, struct json_object * column);
 %}
 
 %define api.value.type {struct json_object *}
 
 %token T_CREATE T_TABLE T_IDENTIFIER T_DBL_QUOTED T_INT T_UINT T_NUM T_STR T_DROP T_INSERT T_VALUES T_INTO
     T_INT_LITERAL T_UINT_LITERAL T_NUM_LITERAL T_STR_LITERAL T_NULL T_DELETE T_FROM T_WHERE T_JOIN T_ON
-    T_EQ_OP T_NE_OP T_LT_OP T_GT_OP T_LE_OP T_GE_OP T_SELECT T_ASTERISK T_OFFSET T_LIMIT T_UPDATE T_SET
+    T_EQ_OP T_NE_OP T_LT_OP T_GT_OP T_LE_OP T_GE_OP T_SELECT T_ASTERISK T_OFFSET T_LIMIT T_UPDATE T_SET T_VACUUM T_INDEX
+    T_DECLARE T_CURSOR T_FOR T_FETCH T_CLOSE T_COPY T_GROUP T_BY T_ORDER T_ASC T_DESC
 
 %left T_OR_OP
 %left T_AND_OP
@@ -37,6 +41,12 @@ command
     | delete_command        { $$ = $1; }
     | select_command        { $$ = $1; }
     | update_command        { $$ = $1; }
+    | vacuum_command        { $$ = $1; }
+    | create_index_command  { $$ = $1; }
+    | declare_command       { $$ = $1; }
+    | fetch_command         { $$ = $1; }
+    | close_command         { $$ = $1; }
+    | copy_command          { $$ = $1; }
     ;
 
 create_table_command
@@ -93,7 +103,7 @@ drop_table_command
     ;
 
 insert_command
-    : T_INSERT t_into_non_req name braced_names_list_non_req T_VALUES '(' values_list ')'   {
+    : T_INSERT t_into_non_req name braced_names_list_non_req T_VALUES values_tuples_list_req   {
         $$ = json_object_new_object();
 
         json_object_object_add($$, "action", json_object_new_int(2));
@@ -103,10 +113,19 @@ insert_command
             json_object_object_add($$, "columns", $4);
         }
 
-        json_object_object_add($$, "values", $7);
+        json_object_object_add($$, "values", $6);
     }
     ;
 
+values_tuples_list_req
+    : values_tuple                              { $$ = json_object_new_array(); json_object_array_add($$, $1); }
+    | values_tuples_list_req ',' values_tuple   { $$ = $1; json_object_array_add($$, $3); }
+    ;
+
+values_tuple
+    : '(' values_list ')'   { $$ = $2 ? $2 : json_object_new_array(); }
+    ;
+
 t_into_non_req
     : /* empty */
     | T_INTO
@@ -198,7 +217,8 @@ where_value_op
     ;
 
 select_command
-    : T_SELECT names_list_or_asterisk T_FROM name join_stmts where_stmt_non_req offset_stmt_non_req limit_stmt_non_req {
+    : T_SELECT select_list_or_asterisk T_FROM name join_stmts where_stmt_non_req group_stmt_non_req order_stmt_non_req offset_stmt_non_req
+        limit_stmt_non_req {
         $$ = json_object_new_object();
 
         json_object_object_add($$, "action", json_object_new_int(4));
@@ -217,20 +237,87 @@ select_command
         }
 
         if ($7) {
-            json_object_object_add($$, "offset", $7);
+            json_object_object_add($$, "group", $7);
         }
 
         if ($8) {
-            json_object_object_add($$, "limit", $8);
+            json_object_object_add($$, "order", $8);
+        }
+
+        if ($9) {
+            json_object_object_add($$, "offset", $9);
+        }
+
+        if ($10) {
+            json_object_object_add($$, "limit", $10);
         }
     }
     ;
 
-names_list_or_asterisk
-    : names_list_req    { $$ = $1; }
+select_list_or_asterisk
+    : select_list_req   { $$ = $1; }
     | T_ASTERISK        { $$ = NULL; }
     ;
 
+select_list_req
+    : select_item                       { $$ = json_object_new_array(); json_object_array_add($$, $1); }
+    | select_list_req ',' select_item   { $$ = $1; json_object_array_add($$, $3); }
+    ;
+
+select_item
+    : name                                  { $$ = $1; }
+    | T_IDENTIFIER '(' T_ASTERISK ')'       {
+        $$ = aggregate_column($1, NULL);
+
+        if (!$$) {
+            yyerror(result, error, "unknown aggregate function");
+            YYERROR;
+        }
+    }
+    | T_IDENTIFIER '(' name ')'             {
+        $$ = aggregate_column($1, $3);
+
+        if (!$$) {
+            yyerror(result, error, "unknown aggregate function");
+            YYERROR;
+        }
+    }
+    ;
+
+group_stmt_non_req
+    : /* empty */                   { $$ = NULL; }
+    | T_GROUP T_BY names_list_req   { $$ = $3; }
+    ;
+
+order_stmt_non_req
+    : /* empty */                   { $$ = NULL; }
+    | T_ORDER T_BY order_list_req   { $$ = $3; }
+    ;
+
+order_list_req
+    : order_item                    { $$ = json_object_new_array(); json_object_array_add($$, $1); }
+    | order_list_req ',' order_item { $$ = $1; json_object_array_add($$, $3); }
+    ;
+
+order_item
+    : select_item order_direction   {
+        $$ = $1;
+
+        if (json_object_is_type($1, json_type_string)) {
+            $$ = json_object_new_object();
+            json_object_object_add($$, "column", $1);
+        }
+
+        json_object_object_add($$, "descending", $2);
+    }
+    ;
+
+order_direction
+    : /* empty */   { $$ = json_object_new_boolean(0); }
+    | T_ASC         { $$ = json_object_new_boolean(0); }
+    | T_DESC        { $$ = json_object_new_boolean(1); }
+    ;
+
 join_stmts
     : /* empty */           { $$ = NULL; }
     | join_stmts_non_null   { $$ = $1; }
@@ -304,6 +391,66 @@ update_value
     : name T_EQ_OP value    { $$ = json_object_new_array(); json_object_array_add($$, $1); json_object_array_add($$, $3); }
     ;
 
+create_index_command
+    : T_CREATE T_INDEX name T_ON name '(' name ')'  {
+        $$ = json_object_new_object();
+
+        json_object_object_add($$, "action", json_object_new_int(7));
+        json_object_object_add($$, "index", $3);
+        json_object_object_add($$, "table", $5);
+        json_object_object_add($$, "column", $7);
+    }
+    ;
+
+declare_command
+    : T_DECLARE name T_CURSOR T_FOR select_command  {
+        $$ = $5;
+
+        json_object_object_add($$, "action", json_object_new_int(8));
+        json_object_object_add($$, "cursor", $2);
+    }
+    ;
+
+fetch_command
+    : T_FETCH T_UINT_LITERAL T_FROM name    {
+        $$ = json_object_new_object();
+
+        json_object_object_add($$, "action", json_object_new_int(9));
+        json_object_object_add($$, "cursor", $4);
+        json_object_object_add($$, "amount", $2);
+    }
+    ;
+
+close_command
+    : T_CLOSE name  {
+        $$ = json_object_new_object();
+        json_object_object_add($$, "action", json_object_new_int(10));
+        json_object_object_add($$, "cursor", $2);
+    }
+    ;
+
+copy_command
+    : T_COPY name braced_names_list_non_req T_FROM T_STR_LITERAL    {
+        $$ = json_object_new_object();
+
+        json_object_object_add($$, "action", json_object_new_int(11));
+        json_object_object_add($$, "table", $2);
+
+        if ($3) {
+            json_object_object_add($$, "columns", $3);
+        }
+
+        json_object_object_add($$, "path", $5);
+    }
+    ;
+
+vacuum_command
+    : T_VACUUM  {
+        $$ = json_object_new_object();
+        json_object_object_add($$, "action", json_object_new_int(6));
+    }
+    ;
+
 %%
 
 void yyerror(struct json_object ** result, char ** error, const char * str) {
@@ -311,3 +458,25 @@ void yyerror(struct json_object ** result, char ** error, const char * str) {
 
     *error = strdup(str);
 }
+
+static struct json_object * aggregate_column(struct json_object * function, struct json_object * column) {
+    const char * name = json_object_get_string(function);
+
+    for (int i = JSON_API_AGGREGATE_COUNT; i <= JSON_API_AGGREGATE_AVG; ++i) {
+        if (strcasecmp(name, json_api_aggregate_to_string(i)) != 0 || (!column && i != JSON_API_AGGREGATE_COUNT)) {
+            continue;
+        }
+
+        struct json_object * result = json_object_new_object();
+        json_object_object_add(result, "function", json_object_new_int(i));
+
+        if (column) {
+            json_object_object_add(result, "column", column);
+        }
+
+        json_object_put(function);
+        return result;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,521 @@
+#define _GNU_SOURCE
+
+#include "page_cache.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define MIN_FRAMES_AMOUNT 16
+
+struct page_cache * page_cache_new(int fd, size_t megabytes) {
+    struct stat64 st;
+    if (fstat64(fd, &st) != 0) {
+        return NULL;
+    }
+
+    size_t frames_amount = megabytes * 1024 * 1024 / PAGE_CACHE_PAGE_SIZE;
+    if (frames_amount < MIN_FRAMES_AMOUNT) {
+        frames_amount = MIN_FRAMES_AMOUNT;
+    }
+
+    struct page_cache * cache = malloc(sizeof(*cache));
+
+    cache->fd = fd;
+    cache->wal = NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    cache->size = (uint64_t) st.st_size;
+    cache->file_size = (uint64_t) st.st_size;
+
+    cache->mapping.enabled = false;
+    pthread_rwlock_init(&cache->mapping.lock, NULL);
+    cache->mapping.address = NULL;
+    cache->mapping.length = 0;
+
+    cache->frames.amount = (unsigned int) frames_amount;
+    cache->frames.hand = 0;
+    cache->frames.pages = calloc(frames_amount, sizeof(*cache->frames.pages));
+    cache->frames.memory = malloc(frames_amount * PAGE_CACHE_PAGE_SIZE);
+
+    for (size_t i = 0; i < frames_amount; ++i) {
+        cache->frames.pages[i].data = cache->frames.memory + i * PAGE_CACHE_PAGE_SIZE;
+    }
+
+    cache->lookup.amount = (unsigned int) frames_amount;
+    cache->lookup.buckets = calloc(frames_amount, sizeof(*cache->lookup.buckets));
+
+    return cache;
+}
+
+static int page_cache_remap(struct page_cache * cache) {
+    if (cache->file_size == cache->mapping.length || cache->file_size == 0) {
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&cache->mapping.lock);
+
+    void * address;
+    if (cache->mapping.address) {
+        address = mremap(cache->mapping.address, cache->mapping.length, cache->file_size, MREMAP_MAYMOVE);
+    } else {
+        address = mmap(NULL, cache->file_size, PROT_READ, MAP_SHARED, cache->fd, 0);
+    }
+
+    if (address != MAP_FAILED) {
+        cache->mapping.address = address;
+        cache->mapping.length = cache->file_size;
+    }
+
+    pthread_rwlock_unlock(&cache->mapping.lock);
+    return address == MAP_FAILED ? -1 : 0;
+}
+
+struct page_cache * page_cache_new_mapped(int fd, size_t megabytes) {
+    struct page_cache * cache = page_cache_new(fd, megabytes);
+
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->mapping.enabled = true;
+
+    if (page_cache_remap(cache) != 0) {
+        page_cache_delete(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void page_cache_delete(struct page_cache * cache) {
+    if (cache) {
+        if (cache->mapping.address) {
+            munmap(cache->mapping.address, cache->mapping.length);
+        }
+
+        free(cache->lookup.buckets);
+        free(cache->frames.memory);
+        free(cache->frames.pages);
+        pthread_rwlock_destroy(&cache->mapping.lock);
+        pthread_cond_destroy(&cache->loaded);
+        pthread_mutex_destroy(&cache->lock);
+    }
+
+    free(cache);
+}
+
+static struct page_cache_page ** page_cache_bucket(struct page_cache * cache, uint64_t number) {
+    return &cache->lookup.buckets[number % cache->lookup.amount];
+}
+
+static int page_cache_write_back(struct page_cache * cache, struct page_cache_page * page) {
+    uint64_t offset = page->number * PAGE_CACHE_PAGE_SIZE;
+
+    if (offset >= cache->size) {
+        page->dirty = false;
+        return 0;
+    }
+
+    if (cache->wal) {
+        if (wal_append(cache->wal, page->number, page->data, 0) != 0) {
+            return -1;
+        }
+
+        page->dirty = false;
+        return 0;
+    }
+
+    size_t length = cache->size - offset < PAGE_CACHE_PAGE_SIZE ? cache->size - offset : PAGE_CACHE_PAGE_SIZE;
+    size_t wrote = 0;
+
+    while (wrote < length) {
+        ssize_t ret = pwrite64(cache->fd, page->data + wrote, length - wrote, (off64_t) (offset + wrote));
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        wrote += ret;
+    }
+
+    if (offset + length > cache->file_size) {
+        cache->file_size = offset + length;
+    }
+
+    page->dirty = false;
+    return 0;
+}
+
+static int page_cache_load(struct page_cache * cache, struct page_cache_page * page) {
+    uint64_t offset = page->number * PAGE_CACHE_PAGE_SIZE;
+    uint64_t file_size = cache->file_size;
+    size_t was_read = 0;
+    int result = 0;
+
+    if (cache->wal && wal_contains(cache->wal, page->number)) {
+        if (!wal_read_page(cache->wal, page->number, page->data)) {
+            errno = EIO;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    bool mapped = cache->mapping.enabled && offset < file_size && page_cache_remap(cache) == 0;
+    if (mapped) {
+        pthread_rwlock_rdlock(&cache->mapping.lock);
+    }
+
+    page->loading = true;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (mapped) {
+        was_read = file_size - offset < PAGE_CACHE_PAGE_SIZE ? file_size - offset : PAGE_CACHE_PAGE_SIZE;
+        memcpy(page->data, cache->mapping.address + offset, was_read);
+        pthread_rwlock_unlock(&cache->mapping.lock);
+    }
+
+    while (offset + was_read < file_size && was_read < PAGE_CACHE_PAGE_SIZE) {
+        ssize_t ret = pread64(cache->fd, page->data + was_read, PAGE_CACHE_PAGE_SIZE - was_read, (off64_t) (offset + was_read));
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret < 0) {
+            result = -1;
+            break;
+        }
+
+        if (ret == 0) {
+            break;
+        }
+
+        was_read += ret;
+    }
+
+    memset(page->data + was_read, 0, PAGE_CACHE_PAGE_SIZE - was_read);
+    int error = errno;
+
+    pthread_mutex_lock(&cache->lock);
+    page->loading = false;
+    pthread_cond_broadcast(&cache->loaded);
+
+    errno = error;
+    return result;
+}
+
+static void page_cache_unlink(struct page_cache * cache, struct page_cache_page * page) {
+    struct page_cache_page ** link = page_cache_bucket(cache, page->number);
+    while (*link != page) {
+        link = &(*link)->next_in_bucket;
+    }
+
+    *link = page->next_in_bucket;
+}
+
+static struct page_cache_page * page_cache_evict(struct page_cache * cache) {
+    for (unsigned int i = 0; i < 2 * cache->frames.amount; ++i) {
+        struct page_cache_page * page = &cache->frames.pages[cache->frames.hand];
+        cache->frames.hand = (cache->frames.hand + 1) % cache->frames.amount;
+
+        if (!page->used) {
+            return page;
+        }
+
+        if (page->pins > 0) {
+            continue;
+        }
+
+        if (page->referenced) {
+            page->referenced = false;
+            continue;
+        }
+
+        if (page->dirty && page_cache_write_back(cache, page) != 0) {
+            continue;
+        }
+
+        page_cache_unlink(cache, page);
+        page->used = false;
+        return page;
+    }
+
+    errno = ENOMEM;
+    return NULL;
+}
+
+static struct page_cache_page * page_cache_lookup(struct page_cache * cache, uint64_t number) {
+    for (struct page_cache_page * page = *page_cache_bucket(cache, number); page; page = page->next_in_bucket) {
+        if (page->number == number) {
+            return page;
+        }
+    }
+
+    return NULL;
+}
+
+static void page_cache_release(struct page_cache * cache, struct page_cache_page * page, bool dirty) {
+    if (dirty) {
+        page->dirty = true;
+    }
+
+    if (--page->pins == 0 && page->failed) {
+        page->used = false;
+    }
+}
+
+static struct page_cache_page * page_cache_acquire(struct page_cache * cache, uint64_t number) {
+    struct page_cache_page * page = page_cache_lookup(cache, number);
+
+    if (page) {
+        ++page->pins;
+        page->referenced = true;
+
+        while (page->loading) {
+            pthread_cond_wait(&cache->loaded, &cache->lock);
+        }
+
+        if (page->failed) {
+            page_cache_release(cache, page, false);
+            errno = EIO;
+            return NULL;
+        }
+
+        return page;
+    }
+
+    page = page_cache_evict(cache);
+    if (!page) {
+        return NULL;
+    }
+
+    page->number = number;
+    page->pins = 1;
+    page->used = true;
+    page->loading = false;
+    page->failed = false;
+    page->dirty = false;
+    page->referenced = true;
+
+    struct page_cache_page ** bucket = page_cache_bucket(cache, number);
+    page->next_in_bucket = *bucket;
+    *bucket = page;
+
+    if (page_cache_load(cache, page) != 0) {
+        page->failed = true;
+        page_cache_unlink(cache, page);
+        page_cache_release(cache, page, false);
+        return NULL;
+    }
+
+    return page;
+}
+
+struct page_cache_page * page_cache_pin(struct page_cache * cache, uint64_t number) {
+    pthread_mutex_lock(&cache->lock);
+    struct page_cache_page * page = page_cache_acquire(cache, number);
+    pthread_mutex_unlock(&cache->lock);
+
+    return page;
+}
+
+void page_cache_unpin(struct page_cache * cache, struct page_cache_page * page, bool dirty) {
+    pthread_mutex_lock(&cache->lock);
+    page_cache_release(cache, page, dirty);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static bool page_cache_map(struct page_cache * cache, uint64_t offset, size_t length) {
+    if (page_cache_lookup(cache, offset / PAGE_CACHE_PAGE_SIZE)) {
+        return false;
+    }
+
+    if (cache->wal && wal_contains(cache->wal, offset / PAGE_CACHE_PAGE_SIZE)) {
+        return false;
+    }
+
+    if (offset + length > cache->mapping.length) {
+        if (offset + length > cache->file_size || page_cache_remap(cache) != 0) {
+            return false;
+        }
+    }
+
+    pthread_rwlock_rdlock(&cache->mapping.lock);
+    return true;
+}
+
+int page_cache_read(struct page_cache * cache, uint64_t offset, void * buf, size_t length) {
+    uint8_t * dst = buf;
+
+    while (length > 0) {
+        uint64_t in_page = offset % PAGE_CACHE_PAGE_SIZE;
+        size_t chunk = PAGE_CACHE_PAGE_SIZE - in_page < length ? PAGE_CACHE_PAGE_SIZE - in_page : length;
+
+        pthread_mutex_lock(&cache->lock);
+
+        if (cache->mapping.enabled && page_cache_map(cache, offset, chunk)) {
+            pthread_mutex_unlock(&cache->lock);
+
+            memcpy(dst, cache->mapping.address + offset, chunk);
+            pthread_rwlock_unlock(&cache->mapping.lock);
+        } else {
+            struct page_cache_page * page = page_cache_acquire(cache, offset / PAGE_CACHE_PAGE_SIZE);
+            pthread_mutex_unlock(&cache->lock);
+
+            if (!page) {
+                memset(dst, 0, length);
+                return -1;
+            }
+
+            memcpy(dst, page->data + in_page, chunk);
+
+            pthread_mutex_lock(&cache->lock);
+            page_cache_release(cache, page, false);
+            pthread_mutex_unlock(&cache->lock);
+        }
+
+        dst += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+int page_cache_write(struct page_cache * cache, uint64_t offset, const void * buf, size_t length) {
+    const uint8_t * src = buf;
+
+    pthread_mutex_lock(&cache->lock);
+    if (offset + length > cache->size) {
+        cache->size = offset + length;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    while (length > 0) {
+        uint64_t in_page = offset % PAGE_CACHE_PAGE_SIZE;
+        size_t chunk = PAGE_CACHE_PAGE_SIZE - in_page < length ? PAGE_CACHE_PAGE_SIZE - in_page : length;
+
+        pthread_mutex_lock(&cache->lock);
+        struct page_cache_page * page = page_cache_acquire(cache, offset / PAGE_CACHE_PAGE_SIZE);
+        pthread_mutex_unlock(&cache->lock);
+
+        if (!page) {
+            return -1;
+        }
+
+        memcpy(page->data + in_page, src, chunk);
+
+        pthread_mutex_lock(&cache->lock);
+        page_cache_release(cache, page, true);
+        pthread_mutex_unlock(&cache->lock);
+
+        src += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+static int page_cache_commit(struct page_cache * cache) {
+    struct page_cache_page * last = NULL;
+
+    for (unsigned int i = 0; i < cache->frames.amount; ++i) {
+        struct page_cache_page * page = &cache->frames.pages[i];
+
+        if (!page->used || !page->dirty || page->number * PAGE_CACHE_PAGE_SIZE >= cache->size) {
+            continue;
+        }
+
+        if (last && page_cache_write_back(cache, last) != 0) {
+            return -1;
+        }
+
+        last = page;
+    }
+
+    if (!last && !wal_pending(cache->wal)) {
+        return 0;
+    }
+
+    struct page_cache_page * page = last ? last : page_cache_acquire(cache, 0);
+    if (!page) {
+        return -1;
+    }
+
+    int ret = wal_append(cache->wal, page->number, page->data, cache->size);
+    if (ret == 0) {
+        page->dirty = false;
+    }
+
+    if (!last) {
+        page_cache_release(cache, page, false);
+    }
+
+    return ret;
+}
+
+static int page_cache_flush_pages(struct page_cache * cache) {
+    int ret = 0;
+
+    if (cache->wal) {
+        return page_cache_commit(cache);
+    }
+
+    for (unsigned int i = 0; i < cache->frames.amount; ++i) {
+        struct page_cache_page * page = &cache->frames.pages[i];
+
+        if (page->used && page->dirty && page_cache_write_back(cache, page) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+static int page_cache_checkpoint_pages(struct page_cache * cache) {
+    if (!cache->wal) {
+        return 0;
+    }
+
+    uint64_t size = cache->wal->database_size;
+
+    if (wal_checkpoint(cache->wal, cache->fd) != 0) {
+        return -1;
+    }
+
+    if (size > cache->file_size) {
+        cache->file_size = size;
+    }
+
+    if (size > cache->size) {
+        cache->size = size;
+    }
+
+    return 0;
+}
+
+int page_cache_flush(struct page_cache * cache) {
+    pthread_mutex_lock(&cache->lock);
+    int ret = page_cache_flush_pages(cache);
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
+}
+
+int page_cache_checkpoint(struct page_cache * cache) {
+    pthread_mutex_lock(&cache->lock);
+    int ret = page_cache_checkpoint_pages(cache);
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wal.h"
+
+#define PAGE_CACHE_PAGE_SIZE 4096
+
+struct page_cache_page {
+    uint64_t number;
+    uint8_t * data;
+
+    unsigned int pins;
+    bool used;
+    bool loading;
+    bool failed;
+    bool dirty;
+    bool referenced;
+
+    struct page_cache_page * next_in_bucket;
+};
+
+struct page_cache {
+    int fd;
+    struct wal * wal;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+
+    uint64_t size;
+    uint64_t file_size;
+
+    struct {
+        bool enabled;
+        pthread_rwlock_t lock;
+        uint8_t * address;
+        uint64_t length;
+    } mapping;
+
+    struct {
+        unsigned int amount;
+        unsigned int hand;
+        struct page_cache_page * pages;
+        uint8_t * memory;
+    } frames;
+
+    struct {
+        unsigned int amount;
+        struct page_cache_page ** buckets;
+    } lookup;
+};
+
+struct page_cache * page_cache_new(int fd, size_t megabytes);
+struct page_cache * page_cache_new_mapped(int fd, size_t megabytes);
+void page_cache_delete(struct page_cache * cache);
+
+struct page_cache_page * page_cache_pin(struct page_cache * cache, uint64_t number);
+void page_cache_unpin(struct page_cache * cache, struct page_cache_page * page, bool dirty);
+
+int page_cache_read(struct page_cache * cache, uint64_t offset, void * buf, size_t length);
+int page_cache_write(struct page_cache * cache, uint64_t offset, const void * buf, size_t length);
+
+int page_cache_flush(struct page_cache * cache);
+int page_cache_checkpoint(struct page_cache * cache);
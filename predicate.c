@@ -0,0 +1,282 @@
+#include "predicate.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREDICATE_LESS (1 << 0)
+#define PREDICATE_EQUAL (1 << 1)
+#define PREDICATE_GREATER (1 << 2)
+#define PREDICATE_UNORDERED (1 << 3)
+
+#define PREDICATE_ORDER(a, b) (((a) > (b)) - ((a) < (b)))
+#define PREDICATE_ORDER_NUM(a, b) (isnan(a) || isnan(b) ? 2 : PREDICATE_ORDER(a, b))
+
+static int predicate_compare_int_int(const struct database_value * left, const struct database_value * right) {
+    return PREDICATE_ORDER(left->value._int, right->value._int);
+}
+
+static int predicate_compare_int_uint(const struct database_value * left, const struct database_value * right) {
+    if (left->value._int < 0) {
+        return -1;
+    }
+
+    return PREDICATE_ORDER((uint64_t) left->value._int, right->value.uint);
+}
+
+static int predicate_compare_int_num(const struct database_value * left, const struct database_value * right) {
+    return PREDICATE_ORDER_NUM((double) left->value._int, right->value.num);
+}
+
+static int predicate_compare_uint_int(const struct database_value * left, const struct database_value * right) {
+    if (right->value._int < 0) {
+        return 1;
+    }
+
+    return PREDICATE_ORDER(left->value.uint, (uint64_t) right->value._int);
+}
+
+static int predicate_compare_uint_uint(const struct database_value * left, const struct database_value * right) {
+    return PREDICATE_ORDER(left->value.uint, right->value.uint);
+}
+
+static int predicate_compare_uint_num(const struct database_value * left, const struct database_value * right) {
+    return PREDICATE_ORDER_NUM((double) left->value.uint, right->value.num);
+}
+
+static int predicate_compare_num_int(const struct database_value * left, const struct database_value * right) {
+    return PREDICATE_ORDER_NUM(left->value.num, (double) right->value._int);
+}
+
+static int predicate_compare_num_uint(const struct database_value * left, const struct database_value * right) {
+    return PREDICATE_ORDER_NUM(left->value.num, (double) right->value.uint);
+}
+
+static int predicate_compare_num_num(const struct database_value * left, const struct database_value * right) {
+    return PREDICATE_ORDER_NUM(left->value.num, right->value.num);
+}
+
+static int predicate_compare_str_str(const struct database_value * left, const struct database_value * right) {
+    int order = strcmp(left->value.str, right->value.str);
+    return PREDICATE_ORDER(order, 0);
+}
+
+static predicate_comparator predicate_choose_comparator(enum database_column_type left, enum database_column_type right) {
+    static const predicate_comparator comparators[4][4] = {
+            [STORAGE_COLUMN_TYPE_INT] = {
+                    [STORAGE_COLUMN_TYPE_INT] = predicate_compare_int_int,
+                    [STORAGE_COLUMN_TYPE_UINT] = predicate_compare_int_uint,
+                    [STORAGE_COLUMN_TYPE_NUM] = predicate_compare_int_num,
+            },
+            [STORAGE_COLUMN_TYPE_UINT] = {
+                    [STORAGE_COLUMN_TYPE_INT] = predicate_compare_uint_int,
+                    [STORAGE_COLUMN_TYPE_UINT] = predicate_compare_uint_uint,
+                    [STORAGE_COLUMN_TYPE_NUM] = predicate_compare_uint_num,
+            },
+            [STORAGE_COLUMN_TYPE_NUM] = {
+                    [STORAGE_COLUMN_TYPE_INT] = predicate_compare_num_int,
+                    [STORAGE_COLUMN_TYPE_UINT] = predicate_compare_num_uint,
+                    [STORAGE_COLUMN_TYPE_NUM] = predicate_compare_num_num,
+            },
+            [STORAGE_COLUMN_TYPE_STR] = {
+                    [STORAGE_COLUMN_TYPE_STR] = predicate_compare_str_str,
+            },
+    };
+
+    return comparators[left][right];
+}
+
+static uint8_t predicate_accepted(enum json_api_operator op) {
+    switch (op) {
+        case JSON_API_OPERATOR_EQ:
+            return PREDICATE_EQUAL;
+
+        case JSON_API_OPERATOR_NE:
+            return PREDICATE_LESS | PREDICATE_GREATER | PREDICATE_UNORDERED;
+
+        case JSON_API_OPERATOR_LT:
+            return PREDICATE_LESS;
+
+        case JSON_API_OPERATOR_GT:
+            return PREDICATE_GREATER;
+
+        case JSON_API_OPERATOR_LE:
+            return PREDICATE_LESS | PREDICATE_EQUAL;
+
+        case JSON_API_OPERATOR_GE:
+            return PREDICATE_GREATER | PREDICATE_EQUAL;
+
+        default:
+            return 0;
+    }
+}
+
+static struct predicate_instruction * predicate_emit(struct predicate * predicate, enum predicate_opcode opcode) {
+    struct predicate_instruction * instruction = &predicate->instructions[predicate->amount++];
+
+    memset(instruction, 0, sizeof(*instruction));
+    instruction->opcode = opcode;
+    return instruction;
+}
+
+static unsigned int predicate_size(struct json_api_where * where) {
+    switch (where->op) {
+        case JSON_API_OPERATOR_AND:
+        case JSON_API_OPERATOR_OR:
+            return predicate_size(where->left) + 1 + predicate_size(where->right);
+
+        default:
+            return 1;
+    }
+}
+
+static int predicate_compile_test(struct predicate * predicate, struct database_joined_table * table, struct json_api_where * where) {
+    uint16_t columns_amount = database_joined_table_get_columns_amount(table);
+
+    for (uint16_t i = 0; i < columns_amount; ++i) {
+        struct database_column column = database_joined_table_get_column(table, i);
+
+        if (strcmp(column.name, where->column) != 0) {
+            continue;
+        }
+
+        struct predicate_instruction * instruction = predicate_emit(predicate, PREDICATE_OPCODE_TEST);
+        instruction->test.column = i;
+        instruction->test.value = where->value;
+        instruction->test.accepted = predicate_accepted(where->op);
+
+        if (where->value) {
+            instruction->test.if_null = where->op == JSON_API_OPERATOR_NE;
+            instruction->test.compare = predicate_choose_comparator(column.type, where->value->type);
+
+            if (!instruction->test.compare) {
+                instruction->test.accepted = where->op == JSON_API_OPERATOR_NE ? PREDICATE_LESS | PREDICATE_EQUAL | PREDICATE_GREATER : 0;
+            }
+        } else {
+            instruction->test.if_null = where->op == JSON_API_OPERATOR_EQ;
+        }
+
+        return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int predicate_compile_node(struct predicate * predicate, struct database_joined_table * table, struct json_api_where * where) {
+    switch (where->op) {
+        case JSON_API_OPERATOR_AND:
+        case JSON_API_OPERATOR_OR:
+        {
+            if (predicate_compile_node(predicate, table, where->left) != 0) {
+                return -1;
+            }
+
+            unsigned int jump = predicate->amount;
+            predicate_emit(predicate, where->op == JSON_API_OPERATOR_AND
+                ? PREDICATE_OPCODE_JUMP_IF_FALSE : PREDICATE_OPCODE_JUMP_IF_TRUE);
+
+            if (predicate_compile_node(predicate, table, where->right) != 0) {
+                return -1;
+            }
+
+            predicate->instructions[jump].target = predicate->amount;
+            return 0;
+        }
+
+        default:
+            return predicate_compile_test(predicate, table, where);
+    }
+}
+
+struct predicate * predicate_compile(struct database_joined_table * table, struct json_api_where * where, struct arena * arena) {
+    struct predicate * predicate = arena_alloc(arena, sizeof(*predicate));
+
+    predicate->amount = 0;
+    predicate->instructions = NULL;
+
+    if (where) {
+        predicate->instructions = arena_alloc(arena, sizeof(*predicate->instructions) * predicate_size(where));
+
+        if (predicate_compile_node(predicate, table, where) != 0) {
+            return NULL;
+        }
+    }
+
+    return predicate;
+}
+
+struct predicate * predicate_compile_table(struct database_joined_table * table, unsigned int index, struct json_api_where * where,
+                                           struct arena * arena) {
+    struct predicate * predicate = predicate_compile(table, where, arena);
+    uint16_t offset = 0;
+
+    for (unsigned int i = 0; i < index; ++i) {
+        offset += table->tables.tables[i].table->columns.amount;
+    }
+
+    for (unsigned int i = 0; predicate && i < predicate->amount; ++i) {
+        if (predicate->instructions[i].opcode == PREDICATE_OPCODE_TEST) {
+            predicate->instructions[i].test.column -= offset;
+        }
+    }
+
+    return predicate;
+}
+
+static bool predicate_test(const struct predicate_instruction * instruction, const struct database_value * value) {
+    if (!value) {
+        return instruction->test.if_null;
+    }
+
+    if (!instruction->test.value) {
+        return !instruction->test.if_null;
+    }
+
+    if (!instruction->test.compare) {
+        return instruction->test.accepted != 0;
+    }
+
+    int order = instruction->test.compare(value, instruction->test.value);
+    return (instruction->test.accepted >> (order + 1)) & 1;
+}
+
+static bool predicate_run(const struct predicate * predicate, struct database_joined_row * joined_row, struct database_row * row,
+                          struct arena * arena) {
+    struct arena_mark mark = arena_save(arena);
+    bool result = true;
+    unsigned int i = 0;
+
+    while (i < predicate->amount) {
+        const struct predicate_instruction * instruction = &predicate->instructions[i];
+
+        switch (instruction->opcode) {
+            case PREDICATE_OPCODE_TEST:
+                result = predicate_test(instruction, joined_row
+                    ? database_joined_row_get_value(joined_row, instruction->test.column, arena)
+                    : database_row_get_value(row, instruction->test.column, arena));
+                ++i;
+                break;
+
+            case PREDICATE_OPCODE_JUMP_IF_FALSE:
+                i = result ? i + 1 : instruction->target;
+                break;
+
+            case PREDICATE_OPCODE_JUMP_IF_TRUE:
+                i = result ? instruction->target : i + 1;
+                break;
+        }
+    }
+
+    arena_restore(arena, mark);
+    return result;
+}
+
+bool predicate_evaluate(const struct predicate * predicate, struct database_joined_row * row, struct arena * arena) {
+    return predicate_run(predicate, row, NULL, arena);
+}
+
+bool predicate_evaluate_row(const struct predicate * predicate, struct database_row * row, struct arena * arena) {
+    return predicate_run(predicate, NULL, row, arena);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "database.h"
+#include "json_commands.h"
+
+enum predicate_opcode {
+    PREDICATE_OPCODE_TEST = 0,
+    PREDICATE_OPCODE_JUMP_IF_FALSE = 1,
+    PREDICATE_OPCODE_JUMP_IF_TRUE = 2,
+};
+
+typedef int (* predicate_comparator)(const struct database_value * left, const struct database_value * right);
+
+struct predicate_instruction {
+    enum predicate_opcode opcode;
+
+    union {
+        struct {
+            uint16_t column;
+            uint8_t accepted;
+            bool if_null;
+            predicate_comparator compare;
+            const struct database_value * value;
+        } test;
+
+        unsigned int target;
+    };
+};
+
+struct predicate {
+    unsigned int amount;
+    struct predicate_instruction * instructions;
+};
+
+struct predicate * predicate_compile(struct database_joined_table * table, struct json_api_where * where, struct arena * arena);
+struct predicate * predicate_compile_table(struct database_joined_table * table, unsigned int index, struct json_api_where * where,
+                                           struct arena * arena);
+
+bool predicate_evaluate(const struct predicate * predicate, struct database_joined_row * row, struct arena * arena);
+bool predicate_evaluate_row(const struct predicate * predicate, struct database_row * row, struct arena * arena);
@@ -0,0 +1,93 @@
+#include "result_stream.h"
+#include "binary_commands.h"
+#include "json_commands.h"
+
+static void result_stream_prepare(struct result_stream * stream) {
+    stream->buffer.size = 0;
+
+    if (stream->framed) {
+        buffer_reserve(&stream->buffer, JSON_API_FRAME_HEADER_SIZE);
+    }
+}
+
+static bool result_stream_flush(struct result_stream * stream, bool last) {
+    if (stream->framed) {
+        uint32_t length = (uint32_t) (stream->buffer.size - JSON_API_FRAME_HEADER_SIZE);
+        json_api_put_frame_header(stream->buffer.data, last ? length : length | JSON_API_FRAME_MORE);
+    }
+
+    bool published = stream->publish(stream, last);
+    stream->published = stream->published || published;
+
+    result_stream_prepare(stream);
+    return published;
+}
+
+void result_stream_reset(struct result_stream * stream) {
+    stream->started = false;
+    stream->published = false;
+    stream->rows = 0;
+    result_stream_prepare(stream);
+}
+
+void result_stream_free(struct result_stream * stream) {
+    buffer_free(&stream->buffer);
+}
+
+bool result_stream_put_object(struct result_stream * stream, struct json_object * object) {
+    stream->started = true;
+
+    if (stream->format == RESULT_STREAM_FORMAT_BINARY) {
+        binary_api_put_object(&stream->buffer, object);
+    } else {
+        size_t length;
+        const char * string = json_object_to_json_string_length(object, JSON_C_TO_STRING_SPACED, &length);
+
+        buffer_append(&stream->buffer, string, length);
+    }
+
+    return result_stream_flush(stream, true);
+}
+
+bool result_stream_begin(struct result_stream * stream, unsigned int amount, const struct database_column * columns) {
+    stream->started = true;
+
+    if (stream->format == RESULT_STREAM_FORMAT_BINARY) {
+        struct json_object * answer = json_api_make_success(json_object_new_object());
+
+        binary_api_put_object(&stream->buffer, answer);
+        binary_api_put_columns(&stream->buffer, amount, columns);
+        json_object_put(answer);
+    } else {
+        json_api_put_columns(&stream->buffer, amount, columns);
+    }
+
+    return true;
+}
+
+bool result_stream_put_row(struct result_stream * stream, unsigned int amount, const struct database_column * columns,
+                           struct database_value ** values) {
+    if (stream->format == RESULT_STREAM_FORMAT_BINARY) {
+        binary_api_put_row(&stream->buffer, amount, columns, values);
+    } else {
+        json_api_put_row(&stream->buffer, amount, values, stream->rows == 0);
+    }
+
+    ++stream->rows;
+
+    if (stream->buffer.size < stream->chunk_size) {
+        return true;
+    }
+
+    return result_stream_flush(stream, false);
+}
+
+bool result_stream_end(struct result_stream * stream) {
+    if (stream->format == RESULT_STREAM_FORMAT_BINARY) {
+        binary_api_put_rows_end(&stream->buffer);
+    } else {
+        json_api_put_rows_end(&stream->buffer);
+    }
+
+    return result_stream_flush(stream, true);
+}
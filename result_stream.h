@@ -0,0 +1,34 @@
+#pragma once
+
+#include <json-c/json.h>
+#include <stdbool.h>
+#include "buffer.h"
+#include "database.h"
+
+enum result_stream_format {
+    RESULT_STREAM_FORMAT_JSON = 0,
+    RESULT_STREAM_FORMAT_BINARY = 1,
+};
+
+struct result_stream {
+    enum result_stream_format format;
+    bool framed;
+    size_t chunk_size;
+
+    bool started;
+    bool published;
+    unsigned long long rows;
+    struct buffer buffer;
+
+    bool (*publish)(struct result_stream * stream, bool last);
+};
+
+void result_stream_reset(struct result_stream * stream);
+void result_stream_free(struct result_stream * stream);
+
+bool result_stream_put_object(struct result_stream * stream, struct json_object * object);
+
+bool result_stream_begin(struct result_stream * stream, unsigned int amount, const struct database_column * columns);
+bool result_stream_put_row(struct result_stream * stream, unsigned int amount, const struct database_column * columns,
+                           struct database_value ** values);
+bool result_stream_end(struct result_stream * stream);
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -5,16 +7,43 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <ctype.h>
+#include <time.h>
 
 #include "database.h"
 #include "json_commands.h"
+#include "binary_commands.h"
+#include "result_stream.h"
+#include "predicate.h"
+#include "csv_reader.h"
+#include "aggregate.h"
+#include "sort.h"
+#include "worker_pool.h"
+
+#define WAL_SUFFIX ("-wal")
+#define REQUEST_ARENA_BLOCK_SIZE (64 * 1024)
+#define CURSOR_ARENA_BLOCK_SIZE (4 * 1024)
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define COPY_BATCH_ROWS 4096
+#define COPY_RECORD_LIMIT (64 * 1024 * 1024)
+#define EVENTS_AMOUNT 64
+#define CONNECTION_CHUNK_SIZE (64 * 1024)
+#define CONNECTION_OUTPUT_LIMIT (1024 * 1024)
+#define CONNECTION_SEND_TIMEOUT 30
+#define CONNECTION_IOV_AMOUNT 64
 
 static volatile bool closing = false;
+static const char * database_path;
+static size_t sort_memory_limit = 64 * 1024 * 1024;
+static int copy_directory = -1;
 
-static void close(int sig, siginfo_t * info, void * context) {
+static void stop(int sig, siginfo_t * info, void * context) {
     closing = true;
 }
 
@@ -33,9 +62,13 @@ static struct json_object * drop_table(struct json_api_drop_table_request reques
 static struct json_object * create_table(struct json_api_create_table_request request, struct database * storage) {
     struct database_table * table = malloc(sizeof(*table));
     table->storage = storage;
+    table->refs = 1;
     table->position = 0;
     table->next = 0;
     table->first_row = 0;
+    table->indexes = NULL;
+    table->next_in_bucket = NULL;
+    table->cataloged = false;
     table->name = strdup(request.table_name);
     table->columns.amount = request.columns.amount;
     table->columns.columns = malloc(sizeof(*table->columns.columns) * request.columns.amount);
@@ -56,6 +89,46 @@ static struct json_object * create_table(struct json_api_create_table_request re
     }
 }
 
+static struct json_object * create_index(struct json_api_create_index_request request, struct database * storage) {
+    if (!request.index_name || !request.table_name || !request.column) {
+        return json_api_make_error("index, table and column are required");
+    }
+
+    struct database_table * table = database_find_table(storage, request.table_name);
+
+    if (!table) {
+        return json_api_make_error("Table with the specified name does not exist");
+    }
+
+    uint16_t column = 0;
+    while (column < table->columns.amount && strcmp(table->columns.columns[column].name, request.column) != 0) {
+        ++column;
+    }
+
+    if (column == table->columns.amount) {
+        database_table_delete(table);
+        return json_api_make_error("column with the specified name does not exist in table");
+    }
+
+    int ret = database_index_add(table, request.index_name, column);
+    database_table_delete(table);
+
+    if (ret == 0) {
+        return json_api_make_success(json_object_new_object());
+    }
+
+    switch (errno) {
+        case EEXIST:
+            return json_api_make_error("An index with the same name already exists");
+
+        case ENOTSUP:
+            return json_api_make_error("Indexes need the current file format, run VACUUM first");
+
+        default:
+            return json_api_make_error("The column is already indexed");
+    }
+}
+
 static struct json_object * map_columns_to_indexes(unsigned int request_columns_amount, char ** request_columns_names,
                                                    struct database_joined_table * table, unsigned int * columns_amount, unsigned int ** columns_indexes) {
     unsigned int columns_count = request_columns_amount;
@@ -155,7 +228,7 @@ static struct json_object * check_values(unsigned int request_values_amount, str
     return NULL;
 }
 
-static struct json_object * handle_insert(struct json_api_insert_request request, struct database * storage) {
+static struct json_object * handle_insert(struct json_api_insert_request request, struct database * storage, struct arena * arena) {
     struct database_table * table = database_find_table(storage, request.table_name);
 
     if (!table) {
@@ -176,25 +249,38 @@ static struct json_object * handle_insert(struct json_api_insert_request request
         }
     }
 
-    {
-        struct json_object * error = check_values(request.values.amount, request.values.values, table, columns_amount, columns_indexes);
+    struct database_value *** rows = arena_alloc(arena, sizeof(*rows) * request.rows.amount);
+
+    for (unsigned int i = 0; i < request.rows.amount; ++i) {
+        struct json_object * error = check_values(request.rows.rows[i].amount, request.rows.rows[i].values, table, columns_amount,
+            columns_indexes);
 
         if (error) {
             free(columns_indexes);
             database_joined_table_delete(joined_table);
             return error;
         }
-    }
 
-    struct database_row * row = database_table_add_row(table);
-    for (unsigned int i = 0; i < columns_amount; ++i) {
-        database_row_set_value(row, columns_indexes[i], request.values.values[i]);
+        rows[i] = arena_alloc(arena, sizeof(**rows) * table->columns.amount);
+        for (uint16_t j = 0; j < table->columns.amount; ++j) {
+            rows[i][j] = NULL;
+        }
+
+        for (unsigned int j = 0; j < columns_amount; ++j) {
+            rows[i][columns_indexes[j]] = request.rows.rows[i].values[j];
+        }
     }
 
     free(columns_indexes);
-    database_row_delete(row);
+
+    database_table_lock(table, true);
+    database_table_insert_rows(table, request.rows.amount, rows);
+    database_table_unlock(table, true);
+
     database_joined_table_delete(joined_table);
-    return json_api_make_success(json_object_new_object());
+    struct json_object * answer = json_object_new_object();
+    json_object_object_add(answer, "amount", json_object_new_uint64(request.rows.amount));
+    return json_api_make_success(answer);
 }
 
 static struct json_object * is_where_correct(struct database_joined_table * table, struct json_api_where * where) {
@@ -492,67 +578,96 @@ static bool compare_values_not_null(enum json_api_operator op, struct database_v
     }
 }
 
-static bool compare_values(enum json_api_operator op, struct database_value * left, struct database_value * right) {
-    switch (op) {
-        case JSON_API_OPERATOR_EQ:
-            if (left == NULL || right == NULL) {
-                return left == NULL && right == NULL;
-            }
+static void tighten_lower(struct database_range * range, struct database_value * value, bool inclusive) {
+    if (range->lower == NULL || compare_values_not_null(JSON_API_OPERATOR_GT, *value, *range->lower)
+        || (!inclusive && compare_values_not_null(JSON_API_OPERATOR_EQ, *value, *range->lower))) {
+        range->lower = value;
+        range->lower_inclusive = inclusive;
+    }
+}
 
-            break;
+static void tighten_upper(struct database_range * range, struct database_value * value, bool inclusive) {
+    if (range->upper == NULL || compare_values_not_null(JSON_API_OPERATOR_LT, *value, *range->upper)
+        || (!inclusive && compare_values_not_null(JSON_API_OPERATOR_EQ, *value, *range->upper))) {
+        range->upper = value;
+        range->upper_inclusive = inclusive;
+    }
+}
 
-        case JSON_API_OPERATOR_NE:
-            if (left == NULL || right == NULL) {
-                return (left == NULL) != (right == NULL);
-            }
+static void collect_ranges(struct database_table * table, struct json_api_where * where, struct database_range * ranges) {
+    if (where->op == JSON_API_OPERATOR_AND) {
+        collect_ranges(table, where->left, ranges);
+        collect_ranges(table, where->right, ranges);
+        return;
+    }
 
+    if (where->op == JSON_API_OPERATOR_NE || where->op == JSON_API_OPERATOR_OR || where->value == NULL) {
+        return;
+    }
+
+    uint16_t column = 0;
+    while (column < table->columns.amount && strcmp(table->columns.columns[column].name, where->column) != 0) {
+        ++column;
+    }
+
+    if (column == table->columns.amount) {
+        return;
+    }
+
+    switch (where->op) {
+        case JSON_API_OPERATOR_EQ:
+            tighten_lower(&ranges[column], where->value, true);
+            tighten_upper(&ranges[column], where->value, true);
             break;
 
         case JSON_API_OPERATOR_LT:
+            tighten_upper(&ranges[column], where->value, false);
+            break;
+
         case JSON_API_OPERATOR_GT:
+            tighten_lower(&ranges[column], where->value, false);
+            break;
+
         case JSON_API_OPERATOR_LE:
-        case JSON_API_OPERATOR_GE:
-            if (left == NULL || right == NULL) {
-                return false;
-            }
+            tighten_upper(&ranges[column], where->value, true);
+            break;
 
+        case JSON_API_OPERATOR_GE:
+            tighten_lower(&ranges[column], where->value, true);
             break;
 
         default:
-            return false;
+            break;
     }
-
-    return compare_values_not_null(op, *left, *right);
 }
 
-static bool evaluate_where(struct database_joined_row * row, struct json_api_where * where) {
-    uint16_t table_columns_amount = database_joined_table_get_columns_amount(row->table);
+static struct database_range choose_range(struct database_table * table, struct json_api_where * where) {
+    struct database_range range = { .index = NULL };
 
-    switch (where->op) {
-        case JSON_API_OPERATOR_EQ:
-        case JSON_API_OPERATOR_NE:
-        case JSON_API_OPERATOR_LT:
-        case JSON_API_OPERATOR_GT:
-        case JSON_API_OPERATOR_LE:
-        case JSON_API_OPERATOR_GE:
-            for (unsigned int i = 0; i < table_columns_amount; ++i) {
-                if (strcmp(database_joined_table_get_column(row->table, i).name, where->column) == 0) {
-                    return compare_values(where->op, database_joined_row_get_value(row, i), where->value);
-                }
-            }
+    if (!where || !table->indexes) {
+        return range;
+    }
 
-            errno = EINVAL;
-            return false;
+    struct database_range ranges[table->columns.amount];
+    memset(ranges, 0, sizeof(ranges));
+    collect_ranges(table, where, ranges);
 
-        case JSON_API_OPERATOR_AND:
-            return evaluate_where(row, where->left) && evaluate_where(row, where->right);
+    int best_score = 0;
+    for (struct database_index * index = table->indexes; index; index = index->next) {
+        struct database_range * candidate = &ranges[index->column];
+        int score = (candidate->lower != NULL) + (candidate->upper != NULL);
 
-        case JSON_API_OPERATOR_OR:
-            return evaluate_where(row, where->left) || evaluate_where(row, where->right);
+        if (score > best_score) {
+            best_score = score;
+            range = *candidate;
+            range.index = index;
+        }
     }
+
+    return range;
 }
 
-static struct json_object * handle_delete(struct json_api_delete_request request, struct database * storage) {
+static struct json_object * handle_delete(struct json_api_delete_request request, struct database * storage, struct arena * arena) {
     struct database_table * table = database_find_table(storage, request.table_name);
 
     if (!table) {
@@ -570,26 +685,158 @@ static struct json_object * handle_delete(struct json_api_delete_request request
         }
     }
 
+    struct predicate * predicate = predicate_compile(joined_table, request.where, arena);
+
+    if (!predicate) {
+        database_joined_table_delete(joined_table);
+        return json_api_make_error(strerror(errno));
+    }
+
+    database_table_lock(table, true);
+
     unsigned long long amount = 0;
-    for (struct database_joined_row * row = database_joined_table_get_first_row(joined_table); row; row = database_joined_row_next(
-            row)) {
-        if (request.where == NULL || evaluate_where(row, request.where)) {
-            database_row_remove(row->rows[0]);
+    struct database_range range = choose_range(table, request.where);
+    struct database_row * row = database_table_scan(table, &range);
+    struct database_joined_row joined_row = { .table = joined_table, .rows = &row };
+
+    while (row) {
+        if (predicate_evaluate(predicate, &joined_row, arena)) {
+            database_row_remove(row);
             ++amount;
         }
+
+        row = database_row_next(row);
     }
 
+    database_table_unlock(table, true);
+
     database_joined_table_delete(joined_table);
     struct json_object * answer = json_object_new_object();
     json_object_object_add(answer, "amount", json_object_new_uint64(amount));
     return json_api_make_success(answer);
 }
 
-static struct json_object * handle_select(struct json_api_select_request request, struct database * storage) {
-    if (request.limit > 1000) {
-        return json_api_make_error("limit is too high");
+static int where_table(struct database_joined_table * table, struct json_api_where * where) {
+    if (where->op == JSON_API_OPERATOR_AND || where->op == JSON_API_OPERATOR_OR) {
+        int left = where_table(table, where->left);
+        int right = where_table(table, where->right);
+
+        return left == right ? left : -1;
+    }
+
+    for (unsigned int i = 0; i < table->tables.amount; ++i) {
+        struct database_table * source = table->tables.tables[i].table;
+
+        for (uint16_t j = 0; j < source->columns.amount; ++j) {
+            if (strcmp(source->columns.columns[j].name, where->column) == 0) {
+                return (int) i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static struct json_api_where * where_and(struct json_api_where * left, struct json_api_where * right, struct arena * arena) {
+    if (!left || !right) {
+        return left ? left : right;
+    }
+
+    struct json_api_where * where = arena_alloc(arena, sizeof(*where));
+    where->op = JSON_API_OPERATOR_AND;
+    where->left = left;
+    where->right = right;
+    return where;
+}
+
+static struct json_api_where * push_down_where(struct database_joined_table * table, struct json_api_where * where,
+                                              struct json_api_where ** filters, struct arena * arena) {
+    if (where->op == JSON_API_OPERATOR_AND) {
+        struct json_api_where * left = push_down_where(table, where->left, filters, arena);
+        struct json_api_where * right = push_down_where(table, where->right, filters, arena);
+
+        return where_and(left, right, arena);
+    }
+
+    int index = where_table(table, where);
+
+    if (index < 0) {
+        return where;
+    }
+
+    filters[index] = where_and(filters[index], where, arena);
+    return NULL;
+}
+
+struct cursor {
+    struct cursor * next;
+    char * name;
+    struct arena * arena;
+
+    struct database_joined_table * table;
+    struct database_joined_row * row;
+    struct predicate * predicate;
+    uint64_t * generations;
+
+    struct {
+        unsigned int amount;
+        unsigned int width;
+        unsigned int * indexes;
+        struct database_column * columns;
+    } columns;
+
+    struct sorter * sorter;
+    unsigned int offset;
+    bool started;
+};
+
+static struct json_object * map_order_keys(struct json_api_select_request request, struct database_joined_table * table,
+                                           unsigned int * width, unsigned int ** indexes, struct sort_key * keys) {
+    char * names[request.order.amount];
+
+    for (unsigned int i = 0; i < request.order.amount; ++i) {
+        if (request.order.columns[i].function != JSON_API_AGGREGATE_NONE) {
+            return json_api_make_error("aggregate functions in ORDER BY require an aggregate query");
+        }
+
+        if (!request.order.columns[i].column) {
+            return json_api_make_error("column in ORDER BY is not specified");
+        }
+
+        names[i] = request.order.columns[i].column;
+    }
+
+    unsigned int amount;
+    unsigned int * order_indexes;
+    struct json_object * error = map_columns_to_indexes(request.order.amount, names, table, &amount, &order_indexes);
+
+    if (error) {
+        free(order_indexes);
+        return error;
+    }
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        unsigned int position = 0;
+
+        while (position < *width && (*indexes)[position] != order_indexes[i]) {
+            ++position;
+        }
+
+        if (position == *width) {
+            *indexes = realloc(*indexes, sizeof(**indexes) * (*width + 1));
+            (*indexes)[(*width)++] = order_indexes[i];
+        }
+
+        keys[i].column = position;
+        keys[i].descending = request.order.columns[i].descending;
     }
 
+    free(order_indexes);
+    return NULL;
+}
+
+static struct json_object * cursor_open(struct cursor * cursor, struct json_api_select_request request, struct database * storage,
+                                        size_t sort_limit, struct arena * arena) {
     struct database_table * table = database_find_table(storage, request.table_name);
 
     if (!table) {
@@ -642,6 +889,13 @@ static struct json_object * handle_select(struct json_api_select_request request
             database_joined_table_delete(joined_table);
             return json_api_make_error("column with the specified name does not exist in the join slice");
         }
+
+        struct database_table * inner = joined_table->tables.tables[i + 1].table;
+        uint16_t t_column_index = joined_table->tables.tables[i + 1].t_column_index;
+        struct database_column s_column = database_joined_table_get_column(joined_table, joined_table->tables.tables[i + 1].s_column_index);
+
+        bool indexed = s_column.type == inner->columns.columns[t_column_index].type && database_table_find_index(inner, t_column_index);
+        joined_table->tables.tables[i + 1].method = indexed ? DATABASE_JOIN_INDEX : DATABASE_JOIN_HASH;
     }
 
     if (request.where) {
@@ -651,86 +905,33 @@ static struct json_object * handle_select(struct json_api_select_request request
             database_joined_table_delete(joined_table);
             return error;
         }
-    }
-
-    unsigned int columns_amount;
-    unsigned int * columns_indexes;
-
-    {
-        struct json_object * error = map_columns_to_indexes(request.columns.amount, request.columns.columns,
-            joined_table, &columns_amount, &columns_indexes);
 
-        if (error) {
-            database_joined_table_delete(joined_table);
-            return error;
-        }
+        joined_table->tables.tables[0].range = choose_range(table, request.where);
     }
 
-    struct json_object * answer = json_object_new_object();
-    {
-        struct json_object * columns = json_object_new_array_ext((int) columns_amount);
-
-        for (unsigned int i = 0; i < columns_amount; ++i) {
-            json_object_array_add(columns, json_object_new_string(
-                    database_joined_table_get_column(joined_table, columns_indexes[i]).name));
-        }
-
-        json_object_object_add(answer, "columns", columns);
-    }
+    struct json_api_where * where = request.where;
 
-    {
-        struct json_object * values = json_object_new_array_ext((int) request.limit);
-
-        unsigned int offset = 0, amount = 0;
-        for (struct database_joined_row * row = database_joined_table_get_first_row(joined_table); row; row = database_joined_row_next(
-                row)) {
-            if (request.where == NULL || evaluate_where(row, request.where)) {
-                if (offset < request.offset) {
-                    ++offset;
-                    continue;
-                }
+    if (where) {
+        struct json_api_where ** filters = arena_alloc(arena, sizeof(*filters) * joined_table->tables.amount);
+        memset(filters, 0, sizeof(*filters) * joined_table->tables.amount);
 
-                if (amount == request.limit) {
-                    break;
-                }
+        where = push_down_where(joined_table, where, filters, arena);
 
-                struct json_object * values_row = json_object_new_array_ext((int) columns_amount);
+        for (unsigned int i = 0; i < joined_table->tables.amount; ++i) {
+            if (!filters[i]) {
+                continue;
+            }
 
-                for (unsigned int i = 0; i < columns_amount; ++i) {
-                    json_object_array_add(values_row, json_api_from_value(
-                            database_joined_row_get_value(row, columns_indexes[i])));
-                }
+            joined_table->tables.tables[i].filter = predicate_compile_table(joined_table, i, filters[i], arena);
 
-                json_object_array_add(values, values_row);
-                ++amount;
+            if (!joined_table->tables.tables[i].filter) {
+                database_joined_table_delete(joined_table);
+                return json_api_make_error(strerror(errno));
             }
         }
-
-        json_object_object_add(answer, "values", values);
-    }
-
-    free(columns_indexes);
-    database_joined_table_delete(joined_table);
-    return json_api_make_success(answer);
-}
-
-static struct json_object * handle_update(struct json_api_update_request request, struct database * storage) {
-    struct database_table * table = database_find_table(storage, request.table_name);
-
-    if (!table) {
-        return json_api_make_error("table with the specified name does not exist");
     }
 
-    struct database_joined_table * joined_table = database_joined_table_wrap(table);
-
-    if (request.where) {
-        struct json_object * error = is_where_correct(joined_table, request.where);
-
-        if (error) {
-            database_joined_table_delete(joined_table);
-            return error;
-        }
-    }
+    database_joined_table_plan(joined_table);
 
     unsigned int columns_amount;
     unsigned int * columns_indexes;
@@ -745,8 +946,11 @@ static struct json_object * handle_update(struct json_api_update_request request
         }
     }
 
-    {
-        struct json_object * error = check_values(request.values.amount, request.values.values, table, columns_amount, columns_indexes);
+    unsigned int width = columns_amount;
+    struct sort_key * keys = arena_alloc(arena, sizeof(*keys) * request.order.amount);
+
+    if (request.order.amount > 0) {
+        struct json_object * error = map_order_keys(request, joined_table, &width, &columns_indexes, keys);
 
         if (error) {
             free(columns_indexes);
@@ -755,119 +959,1733 @@ static struct json_object * handle_update(struct json_api_update_request request
         }
     }
 
-    unsigned long long amount = 0;
-    for (struct database_joined_row * row = database_joined_table_get_first_row(joined_table); row; row = database_joined_row_next(
-            row)) {
-        if (request.where == NULL || evaluate_where(row, request.where)) {
-            for (unsigned int i = 0; i < columns_amount; ++i) {
-                database_row_set_value(row->rows[0], columns_indexes[i], request.values.values[i]);
-            }
+    struct predicate * predicate = predicate_compile(joined_table, where, arena);
 
-            ++amount;
-        }
+    if (!predicate) {
+        free(columns_indexes);
+        database_joined_table_delete(joined_table);
+        return json_api_make_error(strerror(errno));
     }
 
-    free(columns_indexes);
-    database_joined_table_delete(joined_table);
-    struct json_object * answer = json_object_new_object();
-    json_object_object_add(answer, "amount", json_object_new_uint64(amount));
-    return json_api_make_success(answer);
-}
-
-static struct json_object * handle_request(struct json_object * request, struct database * storage) {
-    enum json_api_action action = json_api_get_action(request);
+    cursor->table = joined_table;
+    cursor->row = NULL;
+    cursor->predicate = predicate;
+    cursor->generations = arena_alloc(arena, sizeof(*cursor->generations) * joined_table->tables.amount);
+    cursor->columns.amount = columns_amount;
+    cursor->columns.width = width;
+    cursor->columns.indexes = columns_indexes;
+    cursor->columns.columns = arena_alloc(arena, sizeof(*cursor->columns.columns) * columns_amount);
+    cursor->sorter = NULL;
+    cursor->offset = request.offset;
+    cursor->started = false;
+
+    if (request.order.amount > 0) {
+        cursor->sorter = sorter_new(width, request.order.amount, keys, sort_limit, sort_memory_limit);
+    }
 
-    switch (action) {
-        case JSON_API_TYPE_CREATE_TABLE:
-            return create_table(json_api_to_create_table_request(request), storage);
+    for (unsigned int i = 0; i < columns_amount; ++i) {
+        cursor->columns.columns[i] = database_joined_table_get_column(joined_table, columns_indexes[i]);
+    }
 
-        case JSON_API_TYPE_DROP_TABLE:
-            return drop_table(json_api_to_drop_table_request(request), storage);
+    return NULL;
+}
 
-        case JSON_API_TYPE_INSERT:
-            return handle_insert(json_api_to_insert_request(request), storage);
+static void cursor_close(struct cursor * cursor) {
+    sorter_delete(cursor->sorter);
+    database_joined_row_delete(cursor->row);
+    free(cursor->columns.indexes);
+    database_joined_table_delete(cursor->table);
+}
 
-        case JSON_API_TYPE_DELETE:
-            return handle_delete(json_api_to_delete_request(request), storage);
+static void cursor_delete(struct cursor * cursor) {
+    cursor_close(cursor);
+    arena_delete(cursor->arena);
+}
 
-        case JSON_API_TYPE_SELECT:
-            return handle_select(json_api_to_select_request(request), storage);
+static struct cursor * cursor_find(struct cursor * cursors, const char * name) {
+    for (struct cursor * cursor = cursors; cursor; cursor = cursor->next) {
+        if (strcmp(cursor->name, name) == 0) {
+            return cursor;
+        }
+    }
 
-        case JSON_API_TYPE_UPDATE:
-            return handle_update(json_api_to_update_request(request), storage);
+    return NULL;
+}
 
-        default:
-            return NULL;
+static bool cursor_is_valid(struct cursor * cursor) {
+    for (unsigned int i = 0; i < cursor->table->tables.amount; ++i) {
+        if (cursor->table->tables.tables[i].table->generation != cursor->generations[i]) {
+            return false;
+        }
     }
+
+    return true;
 }
 
-static void process_client(int socket, struct database * storage) {
-    printf("Connected\n");
+static struct json_object * cursor_sort(struct cursor * cursor, struct arena * arena) {
+    struct database_value ** values = arena_alloc(arena, sizeof(*values) * cursor->columns.width);
+    int result = 0;
 
-    while (!closing) {
-        char buffer[64 * 1024];
+    database_joined_table_lock(cursor->table);
 
-        ssize_t was_read = read(socket, buffer, sizeof(buffer) / sizeof(*buffer));
-        if (was_read <= 0) {
-            break;
-        }
+    struct database_joined_row * row = database_joined_table_get_first_row(cursor->table);
+    while (row && result == 0) {
+        struct arena_mark mark = arena_save(arena);
 
-        if (was_read == sizeof(buffer) / sizeof(*buffer)) {
-            buffer[sizeof(buffer) / sizeof(*buffer) - 1] = '\0';
-        } else {
-            buffer[was_read] = '\0';
-        }
-        struct json_object * request = json_tokener_parse(buffer);
-        printf("Request: %s\n", json_object_to_json_string_ext(request, JSON_C_TO_STRING_PRETTY));
-        struct json_object * response_object = NULL;
+        if (predicate_evaluate(cursor->predicate, row, arena)) {
+            for (unsigned int i = 0; i < cursor->columns.width; ++i) {
+                values[i] = database_joined_row_get_value(row, cursor->columns.indexes[i], arena);
+            }
 
-        if (request) {
-            response_object = handle_request(request, storage);
+            result = sorter_add(cursor->sorter, values);
         }
-        const char * response = json_object_to_json_string(response_object);
-        printf("Response: %s\n", response);
 
-        size_t response_length = strlen(response);
-        while (response_length > 0) {
-            ssize_t wrote = write(socket, response, response_length);
+        arena_restore(arena, mark);
+        row = database_joined_row_next(row);
+    }
 
-            if (wrote <= 0) {
-                break;
-            }
+    database_joined_row_delete(row);
+    database_joined_table_unlock(cursor->table);
 
-            response_length -= wrote;
-            response += wrote;
-        }
+    if (result == 0) {
+        result = sorter_finish(cursor->sorter);
     }
 
-    close(socket);
-    printf("Disconnected\n");
-}
+    if (result != 0) {
+        struct sorter * sorter = cursor->sorter;
+        struct json_object * error = json_api_make_error(strerror(errno));
 
-int main(int argc, char * argv[]) {
-    if (argc < 2) {
-        return 0;
+        cursor->sorter = sorter_new(sorter->width, sorter->keys.amount, sorter->keys.keys, sorter->limit, sorter->memory_limit);
+        sorter_delete(sorter);
+        return error;
     }
 
-    int fd = open(argv[1], O_RDWR);
-    struct database * storage;
+    return NULL;
+}
 
-    if (fd < 0 && errno != ENOENT) {
-        perror("Error while opening file");
-        return errno;
-    }
+static struct json_object * cursor_fetch_sorted(struct cursor * cursor, unsigned int amount, struct result_stream * stream,
+                                                struct arena * arena) {
+    if (!cursor->started) {
+        struct json_object * error = cursor_sort(cursor, arena);
 
-    if (fd < 0 && errno == ENOENT) {
-        fd = open(argv[1], O_CREAT | O_RDWR, 0644);
-        storage = database_init(fd);
-    } else {
-        storage = database_open(fd);
+        if (error) {
+            return error;
+        }
+
+        cursor->started = true;
     }
 
-    int server_socket;
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    bool streaming = result_stream_begin(stream, cursor->columns.amount, cursor->columns.columns);
 
-    struct sockaddr_in server_address;
+    struct database_value ** values;
+    unsigned int fetched = 0;
+    while (streaming && fetched < amount && (values = sorter_next(cursor->sorter))) {
+        if (cursor->offset > 0) {
+            --cursor->offset;
+            continue;
+        }
+
+        streaming = result_stream_put_row(stream, cursor->columns.amount, cursor->columns.columns, values);
+        ++fetched;
+    }
+
+    if (streaming) {
+        result_stream_end(stream);
+    }
+
+    return NULL;
+}
+
+static struct json_object * cursor_fetch(struct cursor * cursor, unsigned int amount, struct result_stream * stream,
+                                         struct arena * arena) {
+    if (cursor->sorter) {
+        return cursor_fetch_sorted(cursor, amount, stream, arena);
+    }
+
+    database_joined_table_lock(cursor->table);
+
+    if (!cursor->started) {
+        for (unsigned int i = 0; i < cursor->table->tables.amount; ++i) {
+            cursor->generations[i] = cursor->table->tables.tables[i].table->generation;
+        }
+
+        cursor->row = database_joined_table_get_first_row(cursor->table);
+        cursor->started = true;
+    } else if (cursor->row && !cursor_is_valid(cursor)) {
+        database_joined_table_unlock(cursor->table);
+        return json_api_make_error("cursor was invalidated by a concurrent modification");
+    } else if (cursor->row) {
+        cursor->row = database_joined_row_refresh(cursor->row);
+    }
+
+    struct database_value ** values = arena_alloc(arena, sizeof(*values) * cursor->columns.amount);
+    bool streaming = result_stream_begin(stream, cursor->columns.amount, cursor->columns.columns);
+
+    unsigned int fetched = 0;
+    while (streaming && cursor->row && fetched < amount) {
+        if (predicate_evaluate(cursor->predicate, cursor->row, arena)) {
+            if (cursor->offset > 0) {
+                --cursor->offset;
+            } else {
+                struct arena_mark mark = arena_save(arena);
+
+                for (unsigned int i = 0; i < cursor->columns.amount; ++i) {
+                    values[i] = database_joined_row_get_value(cursor->row, cursor->columns.indexes[i], arena);
+                }
+
+                streaming = result_stream_put_row(stream, cursor->columns.amount, cursor->columns.columns, values);
+
+                arena_restore(arena, mark);
+                ++fetched;
+            }
+        }
+
+        cursor->row = database_joined_row_next(cursor->row);
+    }
+
+    database_joined_table_unlock(cursor->table);
+
+    if (streaming) {
+        result_stream_end(stream);
+    }
+
+    return NULL;
+}
+
+static bool is_aggregate(struct json_api_select_request request) {
+    if (request.group.amount > 0) {
+        return true;
+    }
+
+    for (unsigned int i = 0; i < request.columns.amount; ++i) {
+        if (request.columns.aggregates[i] != JSON_API_AGGREGATE_NONE) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static struct json_object * map_aggregate_columns(struct json_api_select_request request, struct database_joined_table * table,
+                                                  unsigned int * keys_indexes, struct database_column * columns, int * sources,
+                                                  enum json_api_aggregate * functions, unsigned int * arguments,
+                                                  unsigned int * aggregates_amount, struct arena * arena) {
+    *aggregates_amount = 0;
+
+    for (unsigned int i = 0; i < request.columns.amount; ++i) {
+        enum json_api_aggregate function = request.columns.aggregates[i];
+        char * name = request.columns.columns[i];
+
+        if (function == JSON_API_AGGREGATE_NONE) {
+            sources[i] = -1;
+
+            for (unsigned int j = 0; name && j < request.group.amount; ++j) {
+                if (strcmp(name, request.group.columns[j]) == 0) {
+                    sources[i] = (int) j;
+                    columns[i] = database_joined_table_get_column(table, keys_indexes[j]);
+                    break;
+                }
+            }
+
+            if (sources[i] < 0) {
+                size_t msg_length = 70 + (name ? strlen(name) : 0);
+
+                char msg[msg_length];
+                snprintf(msg, msg_length, "column with name %s must appear in GROUP BY or in an aggregate function", name ? name : "");
+                return json_api_make_error(msg);
+            }
+
+            continue;
+        }
+
+        const char * function_name = json_api_aggregate_to_string(function);
+
+        if (!function_name) {
+            return json_api_make_error("unknown aggregate function");
+        }
+
+        struct database_column column = { .name = "*", .type = STORAGE_COLUMN_TYPE_UINT };
+        unsigned int argument = (unsigned int) -1;
+
+        if (name) {
+            unsigned int amount;
+            unsigned int * indexes;
+
+            struct json_object * error = map_columns_to_indexes(1, &name, table, &amount, &indexes);
+
+            if (error) {
+                free(indexes);
+                return error;
+            }
+
+            argument = indexes[0];
+            column = database_joined_table_get_column(table, argument);
+            free(indexes);
+        } else if (function != JSON_API_AGGREGATE_COUNT) {
+            return json_api_make_error("only COUNT can be applied to *");
+        }
+
+        if (!aggregate_is_applicable(function, column.type)) {
+            const char * type = database_column_type_to_string(column.type);
+            size_t msg_length = 39 + strlen(function_name) + strlen(type);
+
+            char msg[msg_length];
+            snprintf(msg, msg_length, "%s can not be applied to values of type %s", function_name, type);
+            return json_api_make_error(msg);
+        }
+
+        size_t title_length = strlen(function_name) + strlen(column.name) + 3;
+        char * title = arena_alloc(arena, title_length);
+        snprintf(title, title_length, "%s(%s)", function_name, column.name);
+
+        sources[i] = -1 - (int) *aggregates_amount;
+        columns[i].name = title;
+        columns[i].type = aggregate_get_type(function, column.type);
+
+        functions[*aggregates_amount] = function;
+        arguments[*aggregates_amount] = argument;
+        ++*aggregates_amount;
+    }
+
+    return NULL;
+}
+
+static struct json_object * map_aggregate_order(struct json_api_select_request request, struct sort_key * keys) {
+    for (unsigned int i = 0; i < request.order.amount; ++i) {
+        enum json_api_aggregate function = request.order.columns[i].function;
+        char * name = request.order.columns[i].column;
+
+        unsigned int position = 0;
+        for (; position < request.columns.amount; ++position) {
+            char * column = request.columns.columns[position];
+
+            if (request.columns.aggregates[position] == function && (name && column ? strcmp(name, column) == 0 : name == column)) {
+                break;
+            }
+        }
+
+        if (position == request.columns.amount) {
+            return json_api_make_error("ORDER BY expressions of aggregate queries must appear in the select list");
+        }
+
+        keys[i].column = position;
+        keys[i].descending = request.order.columns[i].descending;
+    }
+
+    return NULL;
+}
+
+static void aggregate_row_values(struct aggregate * aggregate, struct aggregate_group * group, unsigned int amount, int * sources,
+                                 struct database_value ** values, struct arena * arena) {
+    for (unsigned int i = 0; i < amount; ++i) {
+        values[i] = sources[i] >= 0 ? group->keys[sources[i]] : aggregate_get_value(aggregate, group, -1 - sources[i], arena);
+    }
+}
+
+static struct json_object * handle_aggregate(struct json_api_select_request request, struct database * storage, struct arena * arena,
+                                            struct result_stream * stream) {
+    if (request.columns.amount == 0) {
+        return json_api_make_error("columns must be listed explicitly in aggregate queries");
+    }
+
+    struct json_api_select_request scan = request;
+    scan.columns.amount = 0;
+    scan.columns.columns = NULL;
+    scan.columns.aggregates = NULL;
+    scan.order.amount = 0;
+
+    struct cursor cursor;
+    struct json_object * error = cursor_open(&cursor, scan, storage, SORT_UNLIMITED, arena);
+
+    if (error) {
+        return error;
+    }
+
+    unsigned int keys_amount = 0;
+    unsigned int * keys_indexes = NULL;
+
+    if (request.group.amount > 0) {
+        error = map_columns_to_indexes(request.group.amount, request.group.columns, cursor.table, &keys_amount, &keys_indexes);
+
+        if (error) {
+            free(keys_indexes);
+            cursor_close(&cursor);
+            return error;
+        }
+    }
+
+    unsigned int columns_amount = request.columns.amount;
+    struct database_column * columns = arena_alloc(arena, sizeof(*columns) * columns_amount);
+    int * sources = arena_alloc(arena, sizeof(*sources) * columns_amount);
+    enum json_api_aggregate * functions = arena_alloc(arena, sizeof(*functions) * columns_amount);
+    unsigned int * arguments = arena_alloc(arena, sizeof(*arguments) * columns_amount);
+    unsigned int aggregates_amount;
+
+    error = map_aggregate_columns(request, cursor.table, keys_indexes, columns, sources, functions, arguments, &aggregates_amount, arena);
+
+    struct sort_key * order_keys = arena_alloc(arena, sizeof(*order_keys) * request.order.amount);
+
+    if (!error) {
+        error = map_aggregate_order(request, order_keys);
+    }
+
+    if (error) {
+        free(keys_indexes);
+        cursor_close(&cursor);
+        return error;
+    }
+
+    static struct database_value any_row = { .type = STORAGE_COLUMN_TYPE_UINT, .value.uint = 1 };
+
+    struct aggregate * aggregate = aggregate_new(keys_amount, aggregates_amount, functions);
+    struct database_value ** keys = arena_alloc(arena, sizeof(*keys) * keys_amount);
+    struct database_value ** values = arena_alloc(arena, sizeof(*values) * columns_amount);
+
+    database_joined_table_lock(cursor.table);
+
+    for (struct database_joined_row * row = database_joined_table_get_first_row(cursor.table); row; row = database_joined_row_next(row)) {
+        struct arena_mark mark = arena_save(arena);
+
+        if (predicate_evaluate(cursor.predicate, row, arena)) {
+            for (unsigned int i = 0; i < keys_amount; ++i) {
+                keys[i] = database_joined_row_get_value(row, keys_indexes[i], arena);
+            }
+
+            for (unsigned int i = 0; i < aggregates_amount; ++i) {
+                values[i] = arguments[i] == (unsigned int) -1 ? &any_row : database_joined_row_get_value(row, arguments[i], arena);
+            }
+
+            aggregate_add(aggregate, keys, values);
+        }
+
+        arena_restore(arena, mark);
+    }
+
+    database_joined_table_unlock(cursor.table);
+
+    struct aggregate_group * group = aggregate_finish(aggregate);
+    struct sorter * sorter = NULL;
+
+    if (request.order.amount > 0) {
+        sorter = sorter_new(columns_amount, request.order.amount, order_keys, (size_t) request.offset + request.limit, sort_memory_limit);
+
+        int result = 0;
+        for (; group && result == 0; group = group->next) {
+            struct arena_mark mark = arena_save(arena);
+
+            aggregate_row_values(aggregate, group, columns_amount, sources, values, arena);
+            result = sorter_add(sorter, values);
+
+            arena_restore(arena, mark);
+        }
+
+        if (result == 0) {
+            result = sorter_finish(sorter);
+        }
+
+        if (result != 0) {
+            error = json_api_make_error(strerror(errno));
+
+            sorter_delete(sorter);
+            aggregate_delete(aggregate);
+            free(keys_indexes);
+            cursor_close(&cursor);
+            return error;
+        }
+    }
+
+    bool streaming = result_stream_begin(stream, columns_amount, columns);
+
+    unsigned int offset = 0, amount = 0;
+    while (streaming && amount < request.limit) {
+        struct arena_mark mark = arena_save(arena);
+        struct database_value ** row = values;
+
+        if (sorter) {
+            row = sorter_next(sorter);
+        } else if (group) {
+            aggregate_row_values(aggregate, group, columns_amount, sources, values, arena);
+            group = group->next;
+        } else {
+            row = NULL;
+        }
+
+        if (!row) {
+            arena_restore(arena, mark);
+            break;
+        }
+
+        if (offset < request.offset) {
+            ++offset;
+        } else {
+            streaming = result_stream_put_row(stream, columns_amount, columns, row);
+            ++amount;
+        }
+
+        arena_restore(arena, mark);
+    }
+
+    if (streaming) {
+        result_stream_end(stream);
+    }
+
+    sorter_delete(sorter);
+    aggregate_delete(aggregate);
+    free(keys_indexes);
+    cursor_close(&cursor);
+    return NULL;
+}
+
+static struct json_object * handle_select(struct json_api_select_request request, struct database * storage, struct arena * arena,
+                                         struct result_stream * stream) {
+    if (request.limit > 1000) {
+        return json_api_make_error("limit is too high");
+    }
+
+    if (is_aggregate(request)) {
+        return handle_aggregate(request, storage, arena, stream);
+    }
+
+    struct cursor cursor;
+    struct json_object * error = cursor_open(&cursor, request, storage, (size_t) request.offset + request.limit, arena);
+
+    if (error) {
+        return error;
+    }
+
+    error = cursor_fetch(&cursor, request.limit, stream, arena);
+    cursor_close(&cursor);
+    return error;
+}
+
+static struct json_object * handle_declare_cursor(struct json_object * object, struct database * storage, struct cursor ** cursors) {
+    struct arena * arena = arena_new(CURSOR_ARENA_BLOCK_SIZE);
+    struct json_api_declare_cursor_request request = json_api_to_declare_cursor_request(object, arena);
+
+    if (!request.cursor_name) {
+        arena_delete(arena);
+        return json_api_make_error("cursor name is not specified");
+    }
+
+    if (cursor_find(*cursors, request.cursor_name)) {
+        arena_delete(arena);
+        return json_api_make_error("cursor with the specified name already exists");
+    }
+
+    if (is_aggregate(request.select)) {
+        arena_delete(arena);
+        return json_api_make_error("cursors can not be declared for aggregate queries");
+    }
+
+    struct cursor * cursor = arena_alloc(arena, sizeof(*cursor));
+    struct json_object * error = cursor_open(cursor, request.select, storage, SORT_UNLIMITED, arena);
+
+    if (error) {
+        arena_delete(arena);
+        return error;
+    }
+
+    cursor->name = request.cursor_name;
+    cursor->arena = arena;
+    cursor->next = *cursors;
+    *cursors = cursor;
+
+    return json_api_make_success(json_object_new_object());
+}
+
+static struct json_object * handle_fetch(struct json_api_fetch_request request, struct cursor * cursors, struct arena * arena,
+                                        struct result_stream * stream) {
+    struct cursor * cursor = request.cursor_name ? cursor_find(cursors, request.cursor_name) : NULL;
+
+    if (!cursor) {
+        return json_api_make_error("cursor with the specified name does not exist");
+    }
+
+    return cursor_fetch(cursor, request.amount, stream, arena);
+}
+
+static struct json_object * handle_close_cursor(struct json_api_close_cursor_request request, struct cursor ** cursors) {
+    for (struct cursor ** cursor = cursors; request.cursor_name && *cursor; cursor = &(*cursor)->next) {
+        if (strcmp((*cursor)->name, request.cursor_name) == 0) {
+            struct cursor * closed = *cursor;
+            *cursor = closed->next;
+
+            cursor_delete(closed);
+            return json_api_make_success(json_object_new_object());
+        }
+    }
+
+    return json_api_make_error("cursor with the specified name does not exist");
+}
+
+static struct json_object * handle_update(struct json_api_update_request request, struct database * storage, struct arena * arena) {
+    struct database_table * table = database_find_table(storage, request.table_name);
+
+    if (!table) {
+        return json_api_make_error("table with the specified name does not exist");
+    }
+
+    struct database_joined_table * joined_table = database_joined_table_wrap(table);
+
+    if (request.where) {
+        struct json_object * error = is_where_correct(joined_table, request.where);
+
+        if (error) {
+            database_joined_table_delete(joined_table);
+            return error;
+        }
+    }
+
+    unsigned int columns_amount;
+    unsigned int * columns_indexes;
+
+    {
+        struct json_object * error = map_columns_to_indexes(request.columns.amount, request.columns.columns,
+            joined_table, &columns_amount, &columns_indexes);
+
+        if (error) {
+            database_joined_table_delete(joined_table);
+            return error;
+        }
+    }
+
+    {
+        struct json_object * error = check_values(request.values.amount, request.values.values, table, columns_amount, columns_indexes);
+
+        if (error) {
+            free(columns_indexes);
+            database_joined_table_delete(joined_table);
+            return error;
+        }
+    }
+
+    struct predicate * predicate = predicate_compile(joined_table, request.where, arena);
+
+    if (!predicate) {
+        free(columns_indexes);
+        database_joined_table_delete(joined_table);
+        return json_api_make_error(strerror(errno));
+    }
+
+    joined_table->tables.tables[0].range = choose_range(table, request.where);
+
+    database_table_lock(table, true);
+
+    unsigned long long amount = 0;
+    for (struct database_joined_row * row = database_joined_table_get_first_row(joined_table); row; row = database_joined_row_next(
+            row)) {
+        if (predicate_evaluate(predicate, row, arena)) {
+            for (unsigned int i = 0; i < columns_amount; ++i) {
+                database_row_set_value(row->rows[0], columns_indexes[i], request.values.values[i]);
+            }
+
+            ++amount;
+        }
+    }
+
+    database_table_unlock(table, true);
+
+    free(columns_indexes);
+    database_joined_table_delete(joined_table);
+    struct json_object * answer = json_object_new_object();
+    json_object_object_add(answer, "amount", json_object_new_uint64(amount));
+    return json_api_make_success(answer);
+}
+
+static int parse_value(const char * field, bool quoted, enum database_column_type type, struct arena * arena,
+                       struct database_value ** value) {
+    if (!quoted && *field == '\0') {
+        *value = NULL;
+        return 0;
+    }
+
+    struct database_value * result = arena_alloc(arena, sizeof(*result));
+    result->type = type;
+
+    char * end = NULL;
+    errno = 0;
+
+    switch (type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            result->value._int = strtoll(field, &end, 10);
+            break;
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            if (*field == '-') {
+                errno = EINVAL;
+                return -1;
+            }
+
+            result->value.uint = strtoull(field, &end, 10);
+            break;
+
+        case STORAGE_COLUMN_TYPE_NUM:
+            result->value.num = strtod(field, &end);
+            break;
+
+        case STORAGE_COLUMN_TYPE_STR:
+            result->value.str = arena_strdup(arena, field);
+            *value = result;
+            return 0;
+    }
+
+    if (errno != 0 || end == field || *end != '\0') {
+        errno = errno ? errno : EINVAL;
+        return -1;
+    }
+
+    *value = result;
+    return 0;
+}
+
+static void copy_flush(struct database_table * table, struct database_value *** rows, unsigned int * batched,
+                       unsigned long long * amount) {
+    if (*batched > 0) {
+        database_table_lock(table, true);
+        database_table_insert_rows(table, *batched, rows);
+        database_table_unlock(table, true);
+
+        *amount += *batched;
+        *batched = 0;
+    }
+}
+
+static bool is_copy_path_correct(const char * path) {
+    if (path[0] == '\0' || path[0] == '/') {
+        return false;
+    }
+
+    for (const char * component = path; component; component = strchr(component, '/')) {
+        if (*component == '/') {
+            ++component;
+        }
+
+        if (strncmp(component, "..", 2) == 0 && (component[2] == '\0' || component[2] == '/')) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static struct json_object * handle_copy(struct json_api_copy_request request, struct database * storage, struct arena * arena) {
+    if (copy_directory < 0) {
+        return json_api_make_error("copy directory is not configured");
+    }
+
+    if (!request.path) {
+        return json_api_make_error("path is not specified");
+    }
+
+    if (!is_copy_path_correct(request.path)) {
+        return json_api_make_error("path must be relative to the copy directory");
+    }
+
+    struct database_table * table = database_find_table(storage, request.table_name);
+
+    if (!table) {
+        return json_api_make_error("table with the specified name does not exist");
+    }
+
+    unsigned int columns_amount;
+    unsigned int * columns_indexes;
+    struct database_joined_table * joined_table = database_joined_table_wrap(table);
+
+    {
+        struct json_object * error = map_columns_to_indexes(request.columns.amount, request.columns.columns,
+            joined_table, &columns_amount, &columns_indexes);
+
+        if (error) {
+            database_joined_table_delete(joined_table);
+            return error;
+        }
+    }
+
+    int fd = openat(copy_directory, request.path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+
+    if (fd < 0) {
+        free(columns_indexes);
+        database_joined_table_delete(joined_table);
+        return json_api_make_error(strerror(errno));
+    }
+
+    struct stat st;
+    int status = fstat(fd, &st);
+
+    if (status != 0 || !S_ISREG(st.st_mode)) {
+        struct json_object * error = json_api_make_error(status != 0 ? strerror(errno) : "path is not a regular file");
+
+        close(fd);
+        free(columns_indexes);
+        database_joined_table_delete(joined_table);
+        return error;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    struct csv_reader * reader = csv_reader_new(fd, COPY_BUFFER_SIZE, COPY_RECORD_LIMIT);
+
+    if (!reader) {
+        struct json_object * error = json_api_make_error(strerror(errno));
+
+        close(fd);
+        free(columns_indexes);
+        database_joined_table_delete(joined_table);
+        return error;
+    }
+
+    struct database_value *** rows = arena_alloc(arena, sizeof(*rows) * COPY_BATCH_ROWS);
+    struct arena_mark mark = arena_save(arena);
+
+    unsigned long long amount = 0;
+    unsigned int batched = 0;
+    char reason[128] = { 0 };
+    int result;
+
+    while ((result = csv_reader_next(reader)) > 0) {
+        if (reader->fields.amount != columns_amount) {
+            snprintf(reason, sizeof(reason), "fields amount isn't equal to columns amount");
+            break;
+        }
+
+        struct database_value ** values = arena_alloc(arena, sizeof(*values) * table->columns.amount);
+        for (uint16_t i = 0; i < table->columns.amount; ++i) {
+            values[i] = NULL;
+        }
+
+        for (unsigned int i = 0; i < columns_amount && !reason[0]; ++i) {
+            struct database_column column = table->columns.columns[columns_indexes[i]];
+
+            if (parse_value(reader->fields.fields[i], reader->fields.quoted[i], column.type, arena, &values[columns_indexes[i]]) != 0) {
+                snprintf(reason, sizeof(reason), "value for column with name %s is not a valid %s",
+                         column.name, database_column_type_to_string(column.type));
+            }
+        }
+
+        if (reason[0]) {
+            break;
+        }
+
+        rows[batched++] = values;
+
+        if (batched == COPY_BATCH_ROWS) {
+            copy_flush(table, rows, &batched, &amount);
+            arena_restore(arena, mark);
+        }
+    }
+
+    if (result < 0) {
+        snprintf(reason, sizeof(reason), "%s", errno == EINVAL ? "malformed quoted field"
+            : errno == EMSGSIZE ? "record too long" : strerror(errno));
+    }
+
+    copy_flush(table, rows, &batched, &amount);
+
+    unsigned long long record = reader->records;
+    csv_reader_delete(reader);
+    close(fd);
+    free(columns_indexes);
+    database_joined_table_delete(joined_table);
+
+    if (reason[0]) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "record %llu: %s, %llu rows were copied", record, reason, amount);
+        return json_api_make_error(msg);
+    }
+
+    struct json_object * answer = json_object_new_object();
+    json_object_object_add(answer, "amount", json_object_new_uint64(amount));
+    return json_api_make_success(answer);
+}
+
+static struct json_object * handle_vacuum(struct database * storage) {
+    if (database_compact(storage, database_path) != 0) {
+        return json_api_make_error(strerror(errno));
+    }
+
+    return json_api_make_success(json_object_new_object());
+}
+
+static struct json_object * handle_request(struct json_object * request, struct database * storage, struct arena * arena,
+                                          struct result_stream * stream, struct cursor ** cursors) {
+    enum json_api_action action = json_api_get_action(request);
+
+    switch (action) {
+        case JSON_API_TYPE_CREATE_TABLE:
+            return create_table(json_api_to_create_table_request(request, arena), storage);
+
+        case JSON_API_TYPE_DROP_TABLE:
+            return drop_table(json_api_to_drop_table_request(request, arena), storage);
+
+        case JSON_API_TYPE_INSERT:
+            return handle_insert(json_api_to_insert_request(request, arena), storage, arena);
+
+        case JSON_API_TYPE_DELETE:
+            return handle_delete(json_api_to_delete_request(request, arena), storage, arena);
+
+        case JSON_API_TYPE_SELECT:
+            return handle_select(json_api_to_select_request(request, arena), storage, arena, stream);
+
+        case JSON_API_TYPE_UPDATE:
+            return handle_update(json_api_to_update_request(request, arena), storage, arena);
+
+        case JSON_API_TYPE_VACUUM:
+            return handle_vacuum(storage);
+
+        case JSON_API_TYPE_CREATE_INDEX:
+            return create_index(json_api_to_create_index_request(request, arena), storage);
+
+        case JSON_API_TYPE_DECLARE_CURSOR:
+            return handle_declare_cursor(request, storage, cursors);
+
+        case JSON_API_TYPE_FETCH:
+            return handle_fetch(json_api_to_fetch_request(request, arena), *cursors, arena, stream);
+
+        case JSON_API_TYPE_CLOSE_CURSOR:
+            return handle_close_cursor(json_api_to_close_cursor_request(request, arena), cursors);
+
+        case JSON_API_TYPE_COPY:
+            return handle_copy(json_api_to_copy_request(request, arena), storage, arena);
+
+        default:
+            return NULL;
+    }
+}
+
+struct server {
+    struct database * storage;
+    struct worker_pool * pool;
+
+    int epoll_fd;
+    int event_fd;
+
+    pthread_mutex_t lock;
+    struct connection * ready;
+};
+
+enum connection_protocol {
+    CONNECTION_PROTOCOL_UNKNOWN = 0,
+    CONNECTION_PROTOCOL_STREAM = 1,
+    CONNECTION_PROTOCOL_FRAMED = 2,
+    CONNECTION_PROTOCOL_BINARY = 3,
+};
+
+struct connection_chunk {
+    struct connection_chunk * next;
+    size_t size;
+    size_t sent;
+    uint8_t data[];
+};
+
+struct connection {
+    struct server * server;
+
+    int socket;
+    bool writing;
+    bool busy;
+    bool closed;
+    bool aborted;
+    enum connection_protocol protocol;
+    bool negotiated;
+
+    struct json_tokener * tokener;
+    struct arena * arena;
+
+    struct {
+        uint8_t * data;
+        size_t size;
+        size_t capacity;
+    } input;
+
+    struct {
+        size_t amount;
+        size_t capacity;
+        size_t head;
+        struct json_object ** requests;
+    } pending;
+
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+
+    struct {
+        struct connection_chunk * head;
+        struct connection_chunk * tail;
+        size_t queued;
+    } output;
+
+    struct result_stream stream;
+    struct cursor * cursors;
+
+    struct worker_task task;
+    struct json_object * request;
+
+    bool scheduled;
+    bool finished;
+    struct connection * next_ready;
+};
+
+static void connection_schedule(struct connection * connection, bool finished) {
+    struct server * server = connection->server;
+
+    pthread_mutex_lock(&server->lock);
+    connection->finished = connection->finished || finished;
+
+    if (!connection->scheduled) {
+        connection->scheduled = true;
+        connection->next_ready = server->ready;
+        server->ready = connection;
+    }
+
+    pthread_mutex_unlock(&server->lock);
+
+    uint64_t one = 1;
+    write(server->event_fd, &one, sizeof(one));
+}
+
+static struct connection_chunk * connection_chunk_new(const void * data, size_t length) {
+    struct connection_chunk * chunk = malloc(sizeof(*chunk) + length);
+
+    chunk->next = NULL;
+    chunk->size = length;
+    chunk->sent = 0;
+    memcpy(chunk->data, data, length);
+
+    return chunk;
+}
+
+static void connection_append(struct connection * connection, struct connection_chunk * chunk) {
+    if (connection->output.tail) {
+        connection->output.tail->next = chunk;
+    } else {
+        connection->output.head = chunk;
+    }
+
+    connection->output.tail = chunk;
+    connection->output.queued += chunk->size;
+}
+
+static bool connection_publish(struct result_stream * stream, bool last) {
+    struct connection * connection = (struct connection *) ((char *) stream - offsetof(struct connection, stream));
+    struct connection_chunk * chunk = connection_chunk_new(stream->buffer.data, stream->buffer.size);
+
+    bool failed = database_get_error() != 0;
+
+    pthread_mutex_lock(&connection->lock);
+    connection->aborted = connection->aborted || (failed && stream->published);
+    bool closed = failed || connection->closed || connection->aborted;
+
+    if (!closed) {
+        connection_append(connection, chunk);
+    }
+
+    pthread_mutex_unlock(&connection->lock);
+
+    if (closed) {
+        free(chunk);
+        return false;
+    }
+
+    if (last) {
+        return true;
+    }
+
+    connection_schedule(connection, false);
+
+    struct timespec timeout;
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += CONNECTION_SEND_TIMEOUT;
+
+    pthread_mutex_lock(&connection->lock);
+
+    while (!connection->closed && !closing && connection->output.queued > CONNECTION_OUTPUT_LIMIT) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (now.tv_sec > timeout.tv_sec || (now.tv_sec == timeout.tv_sec && now.tv_nsec >= timeout.tv_nsec)) {
+            connection->aborted = true;
+            break;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_nsec += 100 * 1000 * 1000;
+        if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+            deadline.tv_nsec -= 1000 * 1000 * 1000;
+            ++deadline.tv_sec;
+        }
+
+        pthread_cond_timedwait(&connection->drained, &connection->lock, &deadline);
+    }
+
+    closed = connection->closed || connection->aborted;
+    pthread_mutex_unlock(&connection->lock);
+
+    return !closed;
+}
+
+static struct connection * connection_new(struct server * server, int socket) {
+    struct connection * connection = calloc(1, sizeof(*connection));
+
+    connection->server = server;
+    connection->socket = socket;
+    connection->tokener = json_tokener_new();
+    connection->arena = arena_new(REQUEST_ARENA_BLOCK_SIZE);
+    connection->stream.chunk_size = CONNECTION_CHUNK_SIZE;
+    connection->stream.publish = connection_publish;
+
+    pthread_mutex_init(&connection->lock, NULL);
+    pthread_cond_init(&connection->drained, NULL);
+
+    printf("Connected\n");
+    return connection;
+}
+
+static void connection_delete(struct connection * connection) {
+    if (connection) {
+        close(connection->socket);
+        json_tokener_free(connection->tokener);
+        arena_delete(connection->arena);
+
+        for (size_t i = connection->pending.head; i < connection->pending.amount; ++i) {
+            json_object_put(connection->pending.requests[i]);
+        }
+
+        free(connection->pending.requests);
+        free(connection->input.data);
+        result_stream_free(&connection->stream);
+
+        while (connection->cursors) {
+            struct cursor * next = connection->cursors->next;
+            cursor_delete(connection->cursors);
+            connection->cursors = next;
+        }
+
+        while (connection->output.head) {
+            struct connection_chunk * next = connection->output.head->next;
+            free(connection->output.head);
+            connection->output.head = next;
+        }
+
+        pthread_cond_destroy(&connection->drained);
+        pthread_mutex_destroy(&connection->lock);
+
+        printf("Disconnected\n");
+    }
+
+    free(connection);
+}
+
+static void connection_close(struct connection * connection) {
+    epoll_ctl(connection->server->epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+
+    pthread_mutex_lock(&connection->lock);
+    connection->closed = true;
+    pthread_cond_broadcast(&connection->drained);
+    pthread_mutex_unlock(&connection->lock);
+
+    if (!connection->busy) {
+        connection_delete(connection);
+    }
+}
+
+static void connection_queue(struct connection * connection, const void * data, size_t length) {
+    struct connection_chunk * chunk = connection_chunk_new(data, length);
+
+    pthread_mutex_lock(&connection->lock);
+    connection_append(connection, chunk);
+    pthread_mutex_unlock(&connection->lock);
+}
+
+static int connection_flush(struct connection * connection) {
+    while (true) {
+        struct iovec iov[CONNECTION_IOV_AMOUNT];
+        struct msghdr message = {
+            .msg_iov = iov,
+            .msg_iovlen = 0,
+        };
+
+        pthread_mutex_lock(&connection->lock);
+
+        for (struct connection_chunk * chunk = connection->output.head;
+             chunk && message.msg_iovlen < CONNECTION_IOV_AMOUNT; chunk = chunk->next) {
+            iov[message.msg_iovlen].iov_base = chunk->data + chunk->sent;
+            iov[message.msg_iovlen].iov_len = chunk->size - chunk->sent;
+            ++message.msg_iovlen;
+        }
+
+        pthread_mutex_unlock(&connection->lock);
+
+        if (message.msg_iovlen == 0) {
+            return 0;
+        }
+
+        ssize_t wrote = sendmsg(connection->socket, &message, MSG_NOSIGNAL);
+
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+
+        if (wrote <= 0) {
+            return -1;
+        }
+
+        pthread_mutex_lock(&connection->lock);
+        connection->output.queued -= wrote;
+
+        while (wrote > 0) {
+            struct connection_chunk * chunk = connection->output.head;
+            size_t length = chunk->size - chunk->sent < (size_t) wrote ? chunk->size - chunk->sent : (size_t) wrote;
+
+            chunk->sent += length;
+            wrote -= (ssize_t) length;
+
+            if (chunk->sent == chunk->size) {
+                connection->output.head = chunk->next;
+                free(chunk);
+            }
+        }
+
+        if (!connection->output.head) {
+            connection->output.tail = NULL;
+        }
+
+        if (connection->output.queued <= CONNECTION_OUTPUT_LIMIT) {
+            pthread_cond_broadcast(&connection->drained);
+        }
+
+        pthread_mutex_unlock(&connection->lock);
+    }
+}
+
+static void connection_push(struct connection * connection, struct json_object * request) {
+    if (connection->pending.amount == connection->pending.capacity) {
+        if (connection->pending.head > 0) {
+            connection->pending.amount -= connection->pending.head;
+            memmove(connection->pending.requests, connection->pending.requests + connection->pending.head,
+                sizeof(*connection->pending.requests) * connection->pending.amount);
+            connection->pending.head = 0;
+        } else {
+            connection->pending.capacity = connection->pending.capacity ? 2 * connection->pending.capacity : 8;
+            connection->pending.requests = realloc(connection->pending.requests,
+                sizeof(*connection->pending.requests) * connection->pending.capacity);
+        }
+    }
+
+    connection->pending.requests[connection->pending.amount++] = request;
+}
+
+static bool is_exclusive(enum json_api_action action) {
+    switch (action) {
+        case JSON_API_TYPE_CREATE_TABLE:
+        case JSON_API_TYPE_DROP_TABLE:
+        case JSON_API_TYPE_VACUUM:
+        case JSON_API_TYPE_CREATE_INDEX:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool is_read_only(enum json_api_action action) {
+    switch (action) {
+        case JSON_API_TYPE_SELECT:
+        case JSON_API_TYPE_DECLARE_CURSOR:
+        case JSON_API_TYPE_FETCH:
+        case JSON_API_TYPE_CLOSE_CURSOR:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static void connection_run(struct worker_task * task) {
+    struct connection * connection = (struct connection *) ((char *) task - offsetof(struct connection, task));
+    struct server * server = connection->server;
+    struct json_object * request = connection->request;
+    struct result_stream * stream = &connection->stream;
+
+    printf("Request: %s\n", json_object_to_json_string_ext(request, JSON_C_TO_STRING_PRETTY));
+    struct json_object * response_object = NULL;
+
+    result_stream_reset(stream);
+
+    if (request) {
+        enum json_api_action action = json_api_get_action(request);
+
+        database_lock(server->storage, is_exclusive(action));
+        database_clear_error();
+        response_object = handle_request(request, server->storage, connection->arena, stream, &connection->cursors);
+
+        int error = database_get_error();
+        database_clear_error();
+
+        if (error != 0 && stream->published) {
+            pthread_mutex_lock(&connection->lock);
+            connection->aborted = true;
+            pthread_mutex_unlock(&connection->lock);
+        } else if (error != 0) {
+            json_object_put(response_object);
+            response_object = json_api_make_error(strerror(error));
+            result_stream_reset(stream);
+        }
+
+        if (!is_read_only(action)) {
+            if (database_flush(server->storage) != 0 || database_sync(server->storage) != 0) {
+                perror("Error while committing changes");
+            }
+        }
+
+        database_unlock(server->storage);
+    }
+
+    if (stream->started) {
+        printf("Response: %llu rows\n", stream->rows);
+    } else {
+        printf("Response: %s\n", json_object_to_json_string(response_object));
+        result_stream_put_object(stream, response_object);
+    }
+
+    json_object_put(response_object);
+    json_object_put(request);
+    arena_reset(connection->arena);
+
+    connection->request = NULL;
+    connection_schedule(connection, true);
+}
+
+static void connection_dispatch(struct connection * connection) {
+    if (connection->busy || connection->closed || connection->pending.head == connection->pending.amount) {
+        return;
+    }
+
+    connection->request = connection->pending.requests[connection->pending.head++];
+    connection->busy = true;
+    connection->task.run = connection_run;
+    worker_pool_submit(connection->server->pool, &connection->task);
+}
+
+static void connection_parse_stream(struct connection * connection, const char * data, size_t length) {
+    size_t offset = 0;
+
+    while (offset < length) {
+        struct json_object * request = json_tokener_parse_ex(connection->tokener, data + offset, (int) (length - offset));
+        enum json_tokener_error error = json_tokener_get_error(connection->tokener);
+
+        if (error == json_tokener_continue) {
+            break;
+        }
+
+        if (error != json_tokener_success) {
+            json_tokener_reset(connection->tokener);
+            connection_push(connection, NULL);
+            break;
+        }
+
+        offset += json_tokener_get_parse_end(connection->tokener);
+        json_tokener_reset(connection->tokener);
+        connection_push(connection, request);
+    }
+}
+
+static int connection_parse_frames(struct connection * connection, const char * data, size_t length) {
+    if (connection->input.size + length > connection->input.capacity) {
+        size_t capacity = connection->input.capacity ? connection->input.capacity : 4096;
+
+        while (capacity < connection->input.size + length) {
+            capacity *= 2;
+        }
+
+        connection->input.data = realloc(connection->input.data, capacity);
+        connection->input.capacity = capacity;
+    }
+
+    memcpy(connection->input.data + connection->input.size, data, length);
+    connection->input.size += length;
+
+    size_t offset = 0;
+
+    if (connection->protocol == CONNECTION_PROTOCOL_BINARY && !connection->negotiated) {
+        if (connection->input.size < BINARY_API_MAGIC_SIZE) {
+            return 0;
+        }
+
+        if (memcmp(connection->input.data, BINARY_API_MAGIC, BINARY_API_MAGIC_SIZE) != 0) {
+            return -1;
+        }
+
+        connection_queue(connection, BINARY_API_MAGIC, BINARY_API_MAGIC_SIZE);
+        connection->negotiated = true;
+        offset = BINARY_API_MAGIC_SIZE;
+    }
+
+    while (connection->input.size - offset >= JSON_API_FRAME_HEADER_SIZE) {
+        uint32_t frame_length = json_api_get_frame_length(connection->input.data + offset);
+
+        if (frame_length > JSON_API_FRAME_MAX_SIZE) {
+            return -1;
+        }
+
+        if (connection->input.size - offset - JSON_API_FRAME_HEADER_SIZE < frame_length) {
+            break;
+        }
+
+        const uint8_t * payload = connection->input.data + offset + JSON_API_FRAME_HEADER_SIZE;
+        struct json_object * request = NULL;
+
+        if (connection->protocol == CONNECTION_PROTOCOL_BINARY) {
+            size_t parsed = 0;
+
+            if (binary_api_get_object(payload, frame_length, &parsed, &request) != 0 || parsed != frame_length) {
+                json_object_put(request);
+                request = NULL;
+            }
+        } else {
+            request = json_tokener_parse_ex(connection->tokener, (const char *) payload, (int) frame_length);
+
+            if (json_tokener_get_error(connection->tokener) != json_tokener_success) {
+                json_object_put(request);
+                request = NULL;
+            }
+
+            json_tokener_reset(connection->tokener);
+        }
+
+        connection_push(connection, request);
+        offset += JSON_API_FRAME_HEADER_SIZE + frame_length;
+    }
+
+    connection->input.size -= offset;
+    memmove(connection->input.data, connection->input.data + offset, connection->input.size);
+    return 0;
+}
+
+static int connection_receive(struct connection * connection) {
+    while (true) {
+        char buffer[64 * 1024];
+
+        ssize_t was_read = read(connection->socket, buffer, sizeof(buffer) / sizeof(*buffer));
+
+        if (was_read < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (was_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+
+        if (was_read <= 0) {
+            return -1;
+        }
+
+        if (connection->protocol == CONNECTION_PROTOCOL_UNKNOWN) {
+            if (buffer[0] == BINARY_API_MAGIC[0]) {
+                connection->protocol = CONNECTION_PROTOCOL_BINARY;
+            } else if (buffer[0] == '{' || isspace((unsigned char) buffer[0])) {
+                connection->protocol = CONNECTION_PROTOCOL_STREAM;
+            } else {
+                connection->protocol = CONNECTION_PROTOCOL_FRAMED;
+            }
+
+            connection->stream.framed = connection->protocol != CONNECTION_PROTOCOL_STREAM;
+            connection->stream.format = connection->protocol == CONNECTION_PROTOCOL_BINARY
+                ? RESULT_STREAM_FORMAT_BINARY : RESULT_STREAM_FORMAT_JSON;
+        }
+
+        if (connection->protocol == CONNECTION_PROTOCOL_STREAM) {
+            connection_parse_stream(connection, buffer, (size_t) was_read);
+        } else if (connection_parse_frames(connection, buffer, (size_t) was_read) != 0) {
+            return -1;
+        }
+    }
+}
+
+static int connection_watch(struct connection * connection) {
+    pthread_mutex_lock(&connection->lock);
+    bool writing = connection->output.head != NULL;
+    pthread_mutex_unlock(&connection->lock);
+
+    if (writing == connection->writing) {
+        return 0;
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN | (writing ? EPOLLOUT : 0),
+        .data.ptr = connection,
+    };
+
+    connection->writing = writing;
+    return epoll_ctl(connection->server->epoll_fd, EPOLL_CTL_MOD, connection->socket, &event);
+}
+
+static void connection_progress(struct connection * connection) {
+    if (connection->closed) {
+        return;
+    }
+
+    if (connection_flush(connection) != 0 || connection_watch(connection) != 0) {
+        connection_close(connection);
+    }
+}
+
+static void connection_complete(struct connection * connection) {
+    connection->busy = false;
+
+    if (connection->closed) {
+        connection_delete(connection);
+        return;
+    }
+
+    if (connection->aborted) {
+        connection_close(connection);
+        return;
+    }
+
+    connection_dispatch(connection);
+    connection_progress(connection);
+}
+
+static void server_complete(struct server * server) {
+    uint64_t counter;
+    read(server->event_fd, &counter, sizeof(counter));
+
+    while (true) {
+        pthread_mutex_lock(&server->lock);
+
+        struct connection * connection = server->ready;
+        bool finished = false;
+
+        if (connection) {
+            server->ready = connection->next_ready;
+            connection->scheduled = false;
+            finished = connection->finished;
+            connection->finished = false;
+        }
+
+        pthread_mutex_unlock(&server->lock);
+
+        if (!connection) {
+            break;
+        }
+
+        if (finished) {
+            connection_complete(connection);
+        } else {
+            connection_progress(connection);
+        }
+    }
+}
+
+static void server_accept(struct server * server, int server_socket) {
+    while (true) {
+        int socket = accept4(server_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error while accepting client");
+            }
+
+            if (errno == EINTR && !closing) {
+                continue;
+            }
+
+            return;
+        }
+
+        struct connection * connection = connection_new(server, socket);
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.ptr = connection,
+        };
+
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, socket, &event) != 0) {
+            connection_delete(connection);
+        }
+    }
+}
+
+static void serve(int server_socket, struct database * storage, unsigned int threads) {
+    struct server server = {
+        .storage = storage,
+        .pool = worker_pool_new(threads),
+        .epoll_fd = epoll_create1(EPOLL_CLOEXEC),
+        .event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+        .ready = NULL,
+    };
+
+    pthread_mutex_init(&server.lock, NULL);
+
+    struct epoll_event listen_event = {
+        .events = EPOLLIN,
+        .data.ptr = &server_socket,
+    };
+
+    struct epoll_event complete_event = {
+        .events = EPOLLIN,
+        .data.ptr = &server,
+    };
+
+    if (!server.pool || server.epoll_fd < 0 || server.event_fd < 0
+        || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server_socket, &listen_event) != 0
+        || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.event_fd, &complete_event) != 0) {
+        perror("Cannot start event loop");
+        closing = true;
+    }
+
+    struct epoll_event events[EVENTS_AMOUNT];
+
+    while (!closing) {
+        int amount = epoll_wait(server.epoll_fd, events, EVENTS_AMOUNT, -1);
+
+        if (amount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("Error while waiting for events");
+            break;
+        }
+
+        for (int i = 0; i < amount; ++i) {
+            if (events[i].data.ptr == &server_socket) {
+                server_accept(&server, server_socket);
+                continue;
+            }
+
+            if (events[i].data.ptr == &server) {
+                server_complete(&server);
+                continue;
+            }
+
+            struct connection * connection = events[i].data.ptr;
+            int ret = 0;
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ret = connection_receive(connection);
+                connection_dispatch(connection);
+            }
+
+            if (connection_flush(connection) != 0 || connection_watch(connection) != 0) {
+                ret = -1;
+            }
+
+            if (ret != 0) {
+                connection_close(connection);
+            }
+        }
+    }
+
+    worker_pool_delete(server.pool);
+    pthread_mutex_destroy(&server.lock);
+
+    if (server.event_fd >= 0) {
+        close(server.event_fd);
+    }
+
+    if (server.epoll_fd >= 0) {
+        close(server.epoll_fd);
+    }
+}
+
+int main(int argc, char * argv[]) {
+    struct database_options options = {
+        .cache_size = 64,
+        .wal_fd = -1,
+    };
+
+    bool mapped = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:ms:t:")) != -1) {
+        switch (opt) {
+            case 'c':
+                options.cache_size = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'd':
+                copy_directory = open(optarg, O_RDONLY | O_DIRECTORY);
+
+                if (copy_directory < 0) {
+                    perror("Error while opening copy directory");
+                    return errno;
+                }
+
+                break;
+
+            case 't':
+                threads = strtol(optarg, NULL, 10);
+                break;
+
+            case 'm':
+                mapped = true;
+                break;
+
+            case 's':
+                sort_memory_limit = strtoul(optarg, NULL, 10) * 1024 * 1024;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c cache_megabytes] [-d copy_directory] [-m] [-s sort_megabytes] [-t threads] file\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        return 0;
+    }
+
+    const char * path = argv[optind];
+    database_path = path;
+
+    int fd = open(path, O_RDWR);
+    struct database * storage;
+
+    if (fd < 0 && errno != ENOENT) {
+        perror("Error while opening file");
+        return errno;
+    }
+
+    bool created = fd < 0;
+
+    char wal_path[strlen(path) + sizeof(WAL_SUFFIX)];
+    strcpy(wal_path, path);
+    strcat(wal_path, WAL_SUFFIX);
+
+    options.wal_fd = open(wal_path, O_CREAT | O_RDWR | (created ? O_TRUNC : 0), 0644);
+    if (options.wal_fd < 0) {
+        perror("Error while opening log");
+        return errno;
+    }
+
+    if (created) {
+        fd = open(path, O_CREAT | O_RDWR, 0644);
+        storage = database_init(fd, &options);
+
+        if (storage && mapped) {
+            delete_database(storage);
+            storage = database_open_mapped(fd, &options);
+        }
+    } else if (mapped) {
+        storage = database_open_mapped(fd, &options);
+    } else {
+        storage = database_open(fd, &options);
+    }
+
+    if (!storage) {
+        perror("Error while opening database");
+        return errno;
+    }
+
+    int server_socket;
+    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in server_address;
     server_address.sin_family = AF_INET;
     server_address.sin_port = htons(9002);
     server_address.sin_addr.s_addr = INADDR_ANY;
@@ -877,12 +2695,13 @@ int main(int argc, char * argv[]) {
         return 0;
     }
 
-    listen(server_socket, 1);
+    listen(server_socket, SOMAXCONN);
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
 
     {
         struct sigaction sa;
 
-        sa.sa_sigaction = close;
+        sa.sa_sigaction = stop;
         sigemptyset(&sa.sa_mask);
         sa.sa_flags = SA_SIGINFO;
 
@@ -890,20 +2709,17 @@ int main(int argc, char * argv[]) {
         sigaction(SIGTERM, &sa, NULL);
     }
 
-    while (!closing) {
-        int ret = accept(server_socket, NULL, NULL);
-
-        if (ret < 0) {
-            break;
-        }
-
-        process_client(ret, storage);
-    }
+    serve(server_socket, storage, threads > 0 ? (unsigned int) threads : 1);
 
     close(server_socket);
     delete_database(storage);
+    close(options.wal_fd);
     close(fd);
 
+    if (copy_directory >= 0) {
+        close(copy_directory);
+    }
+
     printf("Bye!\n");
     return 0;
 }
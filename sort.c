@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+
+#include "sort.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SORT_ORDER(a, b) (((a) > (b)) - ((a) < (b)))
+
+struct sorter * sorter_new(unsigned int width, unsigned int keys_amount, const struct sort_key * keys, size_t limit,
+                           size_t memory_limit) {
+    struct sorter * sorter = calloc(1, sizeof(*sorter));
+
+    sorter->width = width;
+    sorter->limit = limit;
+    sorter->memory_limit = memory_limit;
+
+    sorter->keys.amount = keys_amount;
+    sorter->keys.keys = malloc(sizeof(*keys) * keys_amount);
+    memcpy(sorter->keys.keys, keys, sizeof(*keys) * keys_amount);
+
+    return sorter;
+}
+
+void sorter_delete(struct sorter * sorter) {
+    if (sorter) {
+        for (size_t i = 0; i < sorter->rows.amount; ++i) {
+            free(sorter->rows.rows[i]);
+        }
+
+        for (unsigned int i = 0; i < sorter->runs.amount; ++i) {
+            fclose(sorter->runs.sources[i].file);
+            free(sorter->runs.sources[i].row);
+        }
+
+        free(sorter->rows.rows);
+        free(sorter->runs.sources);
+        free(sorter->current);
+        free(sorter->keys.keys);
+    }
+
+    free(sorter);
+}
+
+static struct sort_row * sort_row_new(unsigned int width, struct database_value ** values, uint64_t sequence) {
+    size_t size = sizeof(struct sort_row) + width * (sizeof(struct database_value *) + sizeof(struct database_value));
+
+    for (unsigned int i = 0; i < width; ++i) {
+        if (values[i] && values[i]->type == STORAGE_COLUMN_TYPE_STR) {
+            size += strlen(values[i]->value.str) + 1;
+        }
+    }
+
+    struct sort_row * row = malloc(size);
+    struct database_value * slots = (struct database_value *) (row->values + width);
+    char * strings = (char *) (slots + width);
+
+    row->sequence = sequence;
+    row->size = size;
+
+    for (unsigned int i = 0; i < width; ++i) {
+        row->values[i] = NULL;
+
+        if (!values[i]) {
+            continue;
+        }
+
+        slots[i] = *values[i];
+        row->values[i] = &slots[i];
+
+        if (values[i]->type == STORAGE_COLUMN_TYPE_STR) {
+            size_t length = strlen(values[i]->value.str) + 1;
+
+            memcpy(strings, values[i]->value.str, length);
+            slots[i].value.str = strings;
+            strings += length;
+        }
+    }
+
+    return row;
+}
+
+static int sort_compare_values(const struct database_value * left, const struct database_value * right) {
+    if (!left || !right) {
+        return (left == NULL) - (right == NULL);
+    }
+
+    switch (left->type) {
+        case STORAGE_COLUMN_TYPE_INT:
+            return SORT_ORDER(left->value._int, right->value._int);
+
+        case STORAGE_COLUMN_TYPE_UINT:
+            return SORT_ORDER(left->value.uint, right->value.uint);
+
+        case STORAGE_COLUMN_TYPE_NUM:
+            return SORT_ORDER(left->value.num, right->value.num);
+
+        case STORAGE_COLUMN_TYPE_STR: {
+            int order = strcmp(left->value.str, right->value.str);
+            return SORT_ORDER(order, 0);
+        }
+    }
+
+    return 0;
+}
+
+static int sort_compare(const struct sorter * sorter, const struct sort_row * left, const struct sort_row * right) {
+    for (unsigned int i = 0; i < sorter->keys.amount; ++i) {
+        struct sort_key key = sorter->keys.keys[i];
+        int order = sort_compare_values(left->values[key.column], right->values[key.column]);
+
+        if (order != 0) {
+            return key.descending ? -order : order;
+        }
+    }
+
+    return SORT_ORDER(left->sequence, right->sequence);
+}
+
+static int sort_compare_rows(const void * left, const void * right, void * sorter) {
+    return sort_compare(sorter, *(struct sort_row * const *) left, *(struct sort_row * const *) right);
+}
+
+static void sort_push(struct sorter * sorter, struct sort_row * row) {
+    if (sorter->rows.amount == sorter->rows.capacity) {
+        sorter->rows.capacity = sorter->rows.capacity ? 2 * sorter->rows.capacity : 64;
+        sorter->rows.rows = realloc(sorter->rows.rows, sizeof(*sorter->rows.rows) * sorter->rows.capacity);
+    }
+
+    sorter->rows.rows[sorter->rows.amount++] = row;
+    sorter->rows.memory += row->size;
+}
+
+static void sort_heap_up(struct sorter * sorter, size_t index) {
+    struct sort_row ** rows = sorter->rows.rows;
+
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+
+        if (sort_compare(sorter, rows[parent], rows[index]) >= 0) {
+            break;
+        }
+
+        struct sort_row * row = rows[parent];
+        rows[parent] = rows[index];
+        rows[index] = row;
+        index = parent;
+    }
+}
+
+static void sort_heap_down(struct sorter * sorter, size_t index) {
+    struct sort_row ** rows = sorter->rows.rows;
+
+    while (true) {
+        size_t largest = index;
+
+        for (size_t child = 2 * index + 1; child <= 2 * index + 2 && child < sorter->rows.amount; ++child) {
+            if (sort_compare(sorter, rows[child], rows[largest]) > 0) {
+                largest = child;
+            }
+        }
+
+        if (largest == index) {
+            return;
+        }
+
+        struct sort_row * row = rows[largest];
+        rows[largest] = rows[index];
+        rows[index] = row;
+        index = largest;
+    }
+}
+
+static int sort_write_row(FILE * file, unsigned int width, const struct sort_row * row) {
+    fwrite(&row->sequence, sizeof(row->sequence), 1, file);
+
+    for (unsigned int i = 0; i < width; ++i) {
+        const struct database_value * value = row->values[i];
+        uint8_t tag = value ? 1 + value->type : 0;
+
+        fwrite(&tag, sizeof(tag), 1, file);
+
+        if (!value) {
+            continue;
+        }
+
+        if (value->type == STORAGE_COLUMN_TYPE_STR) {
+            uint32_t length = strlen(value->value.str);
+
+            fwrite(&length, sizeof(length), 1, file);
+            fwrite(value->value.str, 1, length, file);
+        } else {
+            fwrite(&value->value, sizeof(value->value), 1, file);
+        }
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+static struct sort_row * sort_read_row(FILE * file, unsigned int width) {
+    uint64_t sequence;
+
+    if (fread(&sequence, sizeof(sequence), 1, file) != 1) {
+        return NULL;
+    }
+
+    struct database_value slots[width];
+    struct database_value * values[width];
+    bool complete = true;
+
+    for (unsigned int i = 0; i < width; ++i) {
+        uint8_t tag = 0;
+        values[i] = NULL;
+
+        if (complete && fread(&tag, sizeof(tag), 1, file) != 1) {
+            complete = false;
+        }
+
+        if (!complete || tag == 0) {
+            continue;
+        }
+
+        slots[i].type = (enum database_column_type) (tag - 1);
+        values[i] = &slots[i];
+
+        if (slots[i].type == STORAGE_COLUMN_TYPE_STR) {
+            uint32_t length = 0;
+            complete = fread(&length, sizeof(length), 1, file) == 1;
+
+            slots[i].value.str = malloc(length + 1);
+            complete = complete && fread(slots[i].value.str, 1, length, file) == length;
+            slots[i].value.str[length] = '\0';
+        } else {
+            complete = fread(&slots[i].value, sizeof(slots[i].value), 1, file) == 1;
+        }
+    }
+
+    struct sort_row * row = complete ? sort_row_new(width, values, sequence) : NULL;
+
+    for (unsigned int i = 0; i < width; ++i) {
+        if (values[i] && values[i]->type == STORAGE_COLUMN_TYPE_STR) {
+            free(values[i]->value.str);
+        }
+    }
+
+    return row;
+}
+
+static int sort_spill(struct sorter * sorter) {
+    qsort_r(sorter->rows.rows, sorter->rows.amount, sizeof(*sorter->rows.rows), sort_compare_rows, sorter);
+
+    FILE * file = tmpfile();
+
+    if (!file) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < sorter->rows.amount; ++i) {
+        if (sort_write_row(file, sorter->width, sorter->rows.rows[i]) != 0) {
+            fclose(file);
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    if (fflush(file) != 0) {
+        fclose(file);
+        return -1;
+    }
+
+    for (size_t i = 0; i < sorter->rows.amount; ++i) {
+        free(sorter->rows.rows[i]);
+    }
+
+    sorter->rows.amount = 0;
+    sorter->rows.memory = 0;
+
+    if (sorter->runs.amount == sorter->runs.capacity) {
+        sorter->runs.capacity = sorter->runs.capacity ? 2 * sorter->runs.capacity : 8;
+        sorter->runs.sources = realloc(sorter->runs.sources, sizeof(*sorter->runs.sources) * sorter->runs.capacity);
+    }
+
+    sorter->runs.sources[sorter->runs.amount].file = file;
+    sorter->runs.sources[sorter->runs.amount].row = NULL;
+    ++sorter->runs.amount;
+
+    return 0;
+}
+
+int sorter_add(struct sorter * sorter, struct database_value ** values) {
+    if (sorter->limit == 0) {
+        return 0;
+    }
+
+    struct sort_row * row = sort_row_new(sorter->width, values, sorter->sequence++);
+
+    if (sorter->limit != SORT_UNLIMITED) {
+        if (sorter->rows.amount < sorter->limit) {
+            sort_push(sorter, row);
+            sort_heap_up(sorter, sorter->rows.amount - 1);
+        } else if (sort_compare(sorter, row, sorter->rows.rows[0]) < 0) {
+            sorter->rows.memory += row->size - sorter->rows.rows[0]->size;
+            free(sorter->rows.rows[0]);
+
+            sorter->rows.rows[0] = row;
+            sort_heap_down(sorter, 0);
+        } else {
+            free(row);
+        }
+
+        if (sorter->rows.memory > sorter->memory_limit) {
+            sorter->limit = SORT_UNLIMITED;
+            return sort_spill(sorter);
+        }
+
+        return 0;
+    }
+
+    sort_push(sorter, row);
+
+    if (sorter->rows.memory > sorter->memory_limit) {
+        return sort_spill(sorter);
+    }
+
+    return 0;
+}
+
+static void sort_merge_down(struct sorter * sorter, unsigned int index) {
+    struct sort_source * sources = sorter->runs.sources;
+
+    while (true) {
+        unsigned int smallest = index;
+
+        for (unsigned int child = 2 * index + 1; child <= 2 * index + 2 && child < sorter->runs.amount; ++child) {
+            if (sort_compare(sorter, sources[child].row, sources[smallest].row) < 0) {
+                smallest = child;
+            }
+        }
+
+        if (smallest == index) {
+            return;
+        }
+
+        struct sort_source source = sources[smallest];
+        sources[smallest] = sources[index];
+        sources[index] = source;
+        index = smallest;
+    }
+}
+
+static void sort_merge_pop(struct sorter * sorter) {
+    struct sort_source * top = &sorter->runs.sources[0];
+    top->row = sort_read_row(top->file, sorter->width);
+
+    if (!top->row) {
+        fclose(top->file);
+        *top = sorter->runs.sources[--sorter->runs.amount];
+    }
+
+    sort_merge_down(sorter, 0);
+}
+
+int sorter_finish(struct sorter * sorter) {
+    if (sorter->runs.amount == 0) {
+        qsort_r(sorter->rows.rows, sorter->rows.amount, sizeof(*sorter->rows.rows), sort_compare_rows, sorter);
+        return 0;
+    }
+
+    if (sorter->rows.amount > 0 && sort_spill(sorter) != 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < sorter->runs.amount; ) {
+        struct sort_source * source = &sorter->runs.sources[i];
+
+        rewind(source->file);
+        source->row = sort_read_row(source->file, sorter->width);
+
+        if (source->row) {
+            ++i;
+        } else {
+            fclose(source->file);
+            *source = sorter->runs.sources[--sorter->runs.amount];
+        }
+    }
+
+    for (unsigned int i = sorter->runs.amount / 2; i-- > 0; ) {
+        sort_merge_down(sorter, i);
+    }
+
+    sorter->merging = true;
+    return 0;
+}
+
+struct database_value ** sorter_next(struct sorter * sorter) {
+    if (!sorter->merging) {
+        if (sorter->rows.position == sorter->rows.amount) {
+            return NULL;
+        }
+
+        return sorter->rows.rows[sorter->rows.position++]->values;
+    }
+
+    free(sorter->current);
+    sorter->current = NULL;
+
+    if (sorter->runs.amount == 0) {
+        return NULL;
+    }
+
+    sorter->current = sorter->runs.sources[0].row;
+    sort_merge_pop(sorter);
+
+    return sorter->current->values;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "database.h"
+
+#define SORT_UNLIMITED SIZE_MAX
+
+struct sort_key {
+    unsigned int column;
+    bool descending;
+};
+
+struct sort_row {
+    uint64_t sequence;
+    size_t size;
+    struct database_value * values[];
+};
+
+struct sort_source {
+    FILE * file;
+    struct sort_row * row;
+};
+
+struct sorter {
+    unsigned int width;
+    size_t limit;
+    size_t memory_limit;
+    uint64_t sequence;
+
+    struct {
+        unsigned int amount;
+        struct sort_key * keys;
+    } keys;
+
+    struct {
+        size_t amount;
+        size_t capacity;
+        size_t memory;
+        size_t position;
+        struct sort_row ** rows;
+    } rows;
+
+    struct {
+        unsigned int amount;
+        unsigned int capacity;
+        struct sort_source * sources;
+    } runs;
+
+    bool merging;
+    struct sort_row * current;
+};
+
+struct sorter * sorter_new(unsigned int width, unsigned int keys_amount, const struct sort_key * keys, size_t limit,
+                           size_t memory_limit);
+void sorter_delete(struct sorter * sorter);
+
+int sorter_add(struct sorter * sorter, struct database_value ** values);
+int sorter_finish(struct sorter * sorter);
+struct database_value ** sorter_next(struct sorter * sorter);
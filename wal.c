@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+
+#include "wal.h"
+#include "page_cache.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define WAL_BUCKETS_AMOUNT 1024
+#define WAL_CHECKSUM_SEED 14695981039346656037ULL
+
+struct wal_frame_header {
+    uint64_t page;
+    uint64_t database_size;
+    uint64_t checksum;
+};
+
+#define WAL_FRAME_SIZE (sizeof(struct wal_frame_header) + PAGE_CACHE_PAGE_SIZE)
+
+static ssize_t wal_pread(int fd, void * buf, size_t length, uint64_t offset) {
+    size_t was_read = 0;
+
+    while (was_read < length) {
+        ssize_t ret = pread64(fd, (uint8_t *) buf + was_read, length - was_read, (off64_t) (offset + was_read));
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret < 0) {
+            return -1;
+        }
+
+        if (ret == 0) {
+            break;
+        }
+
+        was_read += ret;
+    }
+
+    return (ssize_t) was_read;
+}
+
+static int wal_pwrite(int fd, const void * buf, size_t length, uint64_t offset) {
+    size_t wrote = 0;
+
+    while (wrote < length) {
+        ssize_t ret = pwrite64(fd, (const uint8_t *) buf + wrote, length - wrote, (off64_t) (offset + wrote));
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret < 0) {
+            return -1;
+        }
+
+        wrote += ret;
+    }
+
+    return 0;
+}
+
+static uint64_t wal_checksum(uint64_t checksum, const struct wal_frame_header * header, const uint8_t * data) {
+    const uint8_t * fields = (const uint8_t *) header;
+
+    for (size_t i = 0; i < offsetof(struct wal_frame_header, checksum); ++i) {
+        checksum = (checksum ^ fields[i]) * 1099511628211ULL;
+    }
+
+    for (size_t i = 0; i < PAGE_CACHE_PAGE_SIZE; ++i) {
+        checksum = (checksum ^ data[i]) * 1099511628211ULL;
+    }
+
+    return checksum;
+}
+
+static struct wal_entry ** wal_bucket(struct wal * wal, uint64_t page) {
+    return &wal->index.buckets[page % wal->index.buckets_amount];
+}
+
+static struct wal_entry * wal_lookup(struct wal * wal, uint64_t page) {
+    for (struct wal_entry * entry = *wal_bucket(wal, page); entry; entry = entry->next_in_bucket) {
+        if (entry->page == page) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void wal_index_put(struct wal * wal, uint64_t page, uint64_t offset) {
+    struct wal_entry * entry = wal_lookup(wal, page);
+
+    if (entry) {
+        entry->offset = offset;
+        return;
+    }
+
+    struct wal_entry ** bucket = wal_bucket(wal, page);
+
+    entry = malloc(sizeof(*entry));
+    entry->page = page;
+    entry->offset = offset;
+    entry->next_in_bucket = *bucket;
+    *bucket = entry;
+    ++wal->index.amount;
+}
+
+static void wal_index_clear(struct wal * wal) {
+    for (unsigned int i = 0; i < wal->index.buckets_amount; ++i) {
+        struct wal_entry * entry = wal->index.buckets[i];
+
+        while (entry) {
+            struct wal_entry * next = entry->next_in_bucket;
+            free(entry);
+            entry = next;
+        }
+
+        wal->index.buckets[i] = NULL;
+    }
+
+    wal->index.amount = 0;
+}
+
+static int wal_replay(struct wal * wal) {
+    uint8_t * frame = malloc(WAL_FRAME_SIZE);
+    struct wal_frame_header header;
+
+    uint64_t offset = 0;
+    uint64_t checksum = WAL_CHECKSUM_SEED;
+
+    while (wal_pread(wal->fd, frame, WAL_FRAME_SIZE, offset) == (ssize_t) WAL_FRAME_SIZE) {
+        memcpy(&header, frame, sizeof(header));
+
+        checksum = wal_checksum(checksum, &header, frame + sizeof(header));
+        if (checksum != header.checksum) {
+            break;
+        }
+
+        offset += WAL_FRAME_SIZE;
+
+        if (header.database_size != 0) {
+            wal->committed = offset;
+            wal->checksum = checksum;
+            wal->database_size = header.database_size;
+        }
+    }
+
+    for (offset = 0; offset < wal->committed; offset += WAL_FRAME_SIZE) {
+        wal_pread(wal->fd, &header, sizeof(header), offset);
+        wal_index_put(wal, header.page, offset);
+    }
+
+    free(frame);
+
+    wal->size = wal->committed;
+    wal->sync.durable = wal->committed;
+    return ftruncate64(wal->fd, (off64_t) wal->committed);
+}
+
+struct wal * wal_open(int fd) {
+    struct wal * wal = malloc(sizeof(*wal));
+
+    wal->fd = fd;
+    wal->size = 0;
+    wal->committed = 0;
+    wal->checksum = WAL_CHECKSUM_SEED;
+    wal->database_size = 0;
+
+    wal->index.amount = 0;
+    wal->index.buckets_amount = WAL_BUCKETS_AMOUNT;
+    wal->index.buckets = calloc(WAL_BUCKETS_AMOUNT, sizeof(*wal->index.buckets));
+
+    pthread_mutex_init(&wal->sync.lock, NULL);
+    pthread_cond_init(&wal->sync.done, NULL);
+    wal->sync.running = false;
+    wal->sync.durable = 0;
+
+    if (wal_replay(wal) != 0) {
+        wal_delete(wal);
+        return NULL;
+    }
+
+    return wal;
+}
+
+void wal_delete(struct wal * wal) {
+    if (wal) {
+        wal_index_clear(wal);
+        free(wal->index.buckets);
+
+        pthread_cond_destroy(&wal->sync.done);
+        pthread_mutex_destroy(&wal->sync.lock);
+    }
+
+    free(wal);
+}
+
+bool wal_contains(struct wal * wal, uint64_t page) {
+    return wal_lookup(wal, page) != NULL;
+}
+
+bool wal_read_page(struct wal * wal, uint64_t page, void * data) {
+    struct wal_entry * entry = wal_lookup(wal, page);
+
+    if (!entry) {
+        return false;
+    }
+
+    return wal_pread(wal->fd, data, PAGE_CACHE_PAGE_SIZE, entry->offset + sizeof(struct wal_frame_header))
+        == PAGE_CACHE_PAGE_SIZE;
+}
+
+int wal_append(struct wal * wal, uint64_t page, const void * data, uint64_t database_size) {
+    uint8_t * frame = malloc(WAL_FRAME_SIZE);
+    struct wal_frame_header header = {
+        .page = page,
+        .database_size = database_size,
+    };
+
+    header.checksum = wal_checksum(wal->checksum, &header, data);
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), data, PAGE_CACHE_PAGE_SIZE);
+
+    int ret = wal_pwrite(wal->fd, frame, WAL_FRAME_SIZE, wal->size);
+    free(frame);
+
+    if (ret != 0) {
+        return -1;
+    }
+
+    wal_index_put(wal, page, wal->size);
+    wal->checksum = header.checksum;
+
+    pthread_mutex_lock(&wal->sync.lock);
+    wal->size += WAL_FRAME_SIZE;
+
+    if (database_size != 0) {
+        wal->committed = wal->size;
+        wal->database_size = database_size;
+    }
+
+    pthread_mutex_unlock(&wal->sync.lock);
+    return 0;
+}
+
+bool wal_pending(struct wal * wal) {
+    return wal->size != wal->committed;
+}
+
+uint64_t wal_committed(struct wal * wal) {
+    pthread_mutex_lock(&wal->sync.lock);
+    uint64_t committed = wal->committed;
+    pthread_mutex_unlock(&wal->sync.lock);
+
+    return committed;
+}
+
+uint64_t wal_length(struct wal * wal) {
+    pthread_mutex_lock(&wal->sync.lock);
+    uint64_t size = wal->size;
+    pthread_mutex_unlock(&wal->sync.lock);
+
+    return size;
+}
+
+int wal_sync(struct wal * wal, uint64_t lsn) {
+    int ret = 0;
+
+    pthread_mutex_lock(&wal->sync.lock);
+
+    while (ret == 0 && wal->sync.durable < lsn) {
+        if (wal->sync.running) {
+            pthread_cond_wait(&wal->sync.done, &wal->sync.lock);
+            continue;
+        }
+
+        uint64_t target = wal->committed;
+        wal->sync.running = true;
+        pthread_mutex_unlock(&wal->sync.lock);
+
+        ret = fdatasync(wal->fd);
+
+        pthread_mutex_lock(&wal->sync.lock);
+        wal->sync.running = false;
+
+        if (ret == 0 && target > wal->sync.durable) {
+            wal->sync.durable = target;
+        }
+
+        pthread_cond_broadcast(&wal->sync.done);
+    }
+
+    pthread_mutex_unlock(&wal->sync.lock);
+    return ret;
+}
+
+int wal_checkpoint(struct wal * wal, int fd) {
+    if (wal_pending(wal)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (wal->size == 0) {
+        return 0;
+    }
+
+    uint8_t * data = malloc(PAGE_CACHE_PAGE_SIZE);
+
+    for (unsigned int i = 0; i < wal->index.buckets_amount; ++i) {
+        for (struct wal_entry * entry = wal->index.buckets[i]; entry; entry = entry->next_in_bucket) {
+            uint64_t offset = entry->page * PAGE_CACHE_PAGE_SIZE;
+
+            if (offset >= wal->database_size) {
+                continue;
+            }
+
+            size_t length = wal->database_size - offset < PAGE_CACHE_PAGE_SIZE ? wal->database_size - offset : PAGE_CACHE_PAGE_SIZE;
+
+            if (!wal_read_page(wal, entry->page, data) || wal_pwrite(fd, data, length, offset) != 0) {
+                free(data);
+                return -1;
+            }
+        }
+    }
+
+    free(data);
+
+    if (fsync(fd) != 0 || ftruncate64(wal->fd, 0) != 0) {
+        return -1;
+    }
+
+    wal_index_clear(wal);
+
+    pthread_mutex_lock(&wal->sync.lock);
+    wal->size = 0;
+    wal->committed = 0;
+    wal->sync.durable = 0;
+    pthread_mutex_unlock(&wal->sync.lock);
+
+    wal->checksum = WAL_CHECKSUM_SEED;
+    return 0;
+}
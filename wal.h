@@ -0,0 +1,48 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct wal_entry {
+    uint64_t page;
+    uint64_t offset;
+
+    struct wal_entry * next_in_bucket;
+};
+
+struct wal {
+    int fd;
+
+    uint64_t size;
+    uint64_t committed;
+    uint64_t checksum;
+    uint64_t database_size;
+
+    struct {
+        unsigned int amount;
+        unsigned int buckets_amount;
+        struct wal_entry ** buckets;
+    } index;
+
+    struct {
+        pthread_mutex_t lock;
+        pthread_cond_t done;
+        bool running;
+        uint64_t durable;
+    } sync;
+};
+
+struct wal * wal_open(int fd);
+void wal_delete(struct wal * wal);
+
+bool wal_contains(struct wal * wal, uint64_t page);
+bool wal_read_page(struct wal * wal, uint64_t page, void * data);
+int wal_append(struct wal * wal, uint64_t page, const void * data, uint64_t database_size);
+
+bool wal_pending(struct wal * wal);
+uint64_t wal_committed(struct wal * wal);
+uint64_t wal_length(struct wal * wal);
+int wal_sync(struct wal * wal, uint64_t lsn);
+int wal_checkpoint(struct wal * wal, int fd);
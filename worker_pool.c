@@ -0,0 +1,103 @@
+#include "worker_pool.h"
+
+#include <signal.h>
+#include <stdlib.h>
+
+static struct worker_task * worker_pool_take(struct worker_pool * pool) {
+    pthread_mutex_lock(&pool->lock);
+
+    while (!pool->queue.head && !pool->stopping) {
+        pthread_cond_wait(&pool->available, &pool->lock);
+    }
+
+    struct worker_task * task = pool->queue.head;
+
+    if (task) {
+        pool->queue.head = task->next;
+
+        if (!pool->queue.head) {
+            pool->queue.tail = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return task;
+}
+
+static void * worker_pool_work(void * arg) {
+    struct worker_pool * pool = arg;
+
+    for (struct worker_task * task = worker_pool_take(pool); task; task = worker_pool_take(pool)) {
+        task->run(task);
+    }
+
+    return NULL;
+}
+
+struct worker_pool * worker_pool_new(unsigned int amount) {
+    struct worker_pool * pool = malloc(sizeof(*pool));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+    pool->stopping = false;
+
+    pool->queue.head = NULL;
+    pool->queue.tail = NULL;
+
+    pool->workers.amount = 0;
+    pool->workers.threads = malloc(sizeof(*pool->workers.threads) * amount);
+
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+
+    for (unsigned int i = 0; i < amount; ++i) {
+        if (pthread_create(&pool->workers.threads[pool->workers.amount], NULL, worker_pool_work, pool) == 0) {
+            ++pool->workers.amount;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (pool->workers.amount == 0) {
+        worker_pool_delete(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void worker_pool_delete(struct worker_pool * pool) {
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = true;
+        pthread_cond_broadcast(&pool->available);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (unsigned int i = 0; i < pool->workers.amount; ++i) {
+            pthread_join(pool->workers.threads[i], NULL);
+        }
+
+        free(pool->workers.threads);
+        pthread_cond_destroy(&pool->available);
+        pthread_mutex_destroy(&pool->lock);
+    }
+
+    free(pool);
+}
+
+void worker_pool_submit(struct worker_pool * pool, struct worker_task * task) {
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->queue.tail) {
+        pool->queue.tail->next = task;
+    } else {
+        pool->queue.head = task;
+    }
+
+    pool->queue.tail = task;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+struct worker_task {
+    void (* run)(struct worker_task * task);
+    struct worker_task * next;
+};
+
+struct worker_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    bool stopping;
+
+    struct {
+        struct worker_task * head;
+        struct worker_task * tail;
+    } queue;
+
+    struct {
+        unsigned int amount;
+        pthread_t * threads;
+    } workers;
+};
+
+struct worker_pool * worker_pool_new(unsigned int amount);
+void worker_pool_delete(struct worker_pool * pool);
+
+void worker_pool_submit(struct worker_pool * pool, struct worker_task * task);